@@ -8,6 +8,7 @@
 */
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdbool.h>
@@ -16,6 +17,8 @@
 #include <ctype.h>
 #include <string.h>
 #include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
 __attribute__((noreturn))
 static void die(char const* fmt, ...)
@@ -29,200 +32,168 @@ static void die(char const* fmt, ...)
     exit(EXIT_FAILURE);
 }
 
-typedef int Rank; // 'A', '2', '3', ..., 'J', 'Q', 'K'
-typedef int Suit; // 'S', 'D', 'C', 'H'
+typedef unsigned Rank; // 0='A', 1='2', ... 12='K'
+typedef unsigned Suit; // 0='S', 1='D', 2='C', 3='H'
+
+static char const suit_chars[] = "SDCH";
+static char const rank_chars[] = "A23456789TJQK";
+
+// Each of the 52 cards is represented by a 1-bit in a uint64_t, the same
+// layout as the C++ version.  Each rank within a suit is a 1-bit in a
+// uint16_t.  0x1fff is 13 bits representing all cards in a suit.
+#define ALL_CARDS UINT64_C(0x1fff1fff1fff1fff)
 
 typedef struct Card {
-    Rank rank;
-    Suit suit;
+    uint64_t bit; // a single 1-bit, or 0 if no card
 } Card;
 
-static void Card_init(Card* this, Rank rank, Suit suit)
+static Card Card_make(Rank rank, Suit suit)
 {
-    this->rank = rank;
-    this->suit = suit;
+    assert(rank < sizeof(rank_chars) - 1 && suit < sizeof(suit_chars) - 1);
+    Card card = { UINT64_C(1) << (suit * 16 + rank) };
+    return card;
 }
 
-static bool Card_equal(Card a, Card b)
+static unsigned Card_index(Card card)
 {
-    return a.rank == b.rank && a.suit == b.suit;
+    assert(__builtin_popcountll(card.bit) == 1);
+    return (unsigned) __builtin_ctzll(card.bit);
 }
 
-#define MAX_CARDS 52
-
-typedef struct Hand {
-    size_t num_cards;
-    Card cards[MAX_CARDS];
-} Hand;
-
-static void Hand_init(Hand* this)
+static Rank Card_rank(Card card)
 {
-    this->num_cards = 0;
+    return Card_index(card) % 16;
 }
 
-static size_t Hand_size(Hand const* this)
+static Suit Card_suit(Card card)
 {
-    return this->num_cards;
+    return Card_index(card) / 16;
 }
 
-static void Hand_copy(Hand* this, Hand const* that)
+static int Card_value(Card card)
 {
-    size_t num_cards = that->num_cards;
-    this->num_cards = num_cards;
-    for (size_t i = 0; i < num_cards; ++i)
-        this->cards[i] = that->cards[i];
+    Rank r = Card_rank(card);
+    return r < 10 ? (int) r + 1 : 10; // 1..10
 }
 
-static Card Hand_card(Hand const* this, size_t i)
+static void Card_print(Card card)
 {
-    assert(i < this->num_cards);
-    return this->cards[i];
+    putchar(rank_chars[Card_rank(card)]);
+    putchar(suit_chars[Card_suit(card)]);
 }
 
-static int Hand_value(Hand const* this, size_t i)
+typedef struct Hand {
+    uint64_t cards;
+} Hand;
+
+static void Hand_init(Hand* this)
 {
-    Rank r = Hand_card(this, i).rank;
-    switch (r) {
-    case 'A':
-        return 1;
-    case '2':
-    case '3':
-    case '4':
-    case '5':
-    case '6':
-    case '7':
-    case '8':
-    case '9':
-        return r - '0';
-    case 'T':
-    case 'J':
-    case 'Q':
-    case 'K':
-        return 10;
-    default:
-        assert(false);
-        return 0;
-    }
+    this->cards = 0;
 }
 
-static int Hand_order(Hand const* this, size_t i)
-{
-    Rank r = Hand_card(this, i).rank;
-    switch (r) {
-    case 'A':
-        return 1;
-    case '2':
-    case '3':
-    case '4':
-    case '5':
-    case '6':
-    case '7':
-    case '8':
-    case '9':
-        return r - '0';
-    case 'T':
-        return 10;
-    case 'J':
-        return 11;
-    case 'Q':
-        return 12;
-    case 'K':
-        return 13;
-    default:
-        assert(false);
-        return 0;
-    }
+static size_t Hand_size(Hand const* this)
+{
+    return (size_t) __builtin_popcountll(this->cards);
 }
 
-static void Hand_push(Hand* this, Card card)
+static bool Hand_has(Hand const* this, Card card)
 {
-    assert(this->num_cards < MAX_CARDS);
-    this->cards[this->num_cards++] = card;
+    return (this->cards & card.bit) != 0;
 }
 
-static void Hand_pop(Hand* this)
+static void Hand_insert(Hand* this, Card card)
 {
-    assert(this->num_cards > 0);
-    --this->num_cards;
+    assert(!Hand_has(this, card));
+    this->cards |= card.bit;
 }
 
-static bool Hand_has(Hand const* this, Card card)
+// Remove one card from the hand.
+// Return a zero card if this hand is empty.
+static Card Hand_take(Hand* this)
 {
-    for (size_t i = 0; i != this->num_cards; ++i)
-        if (Card_equal(card, this->cards[i]))
-            return true;
-    return false;
+    uint64_t before = this->cards;
+    this->cards &= this->cards - 1; // clear right-most 1-bit
+    Card card = { before ^ this->cards };
+    return card;
 }
 
-static Hand* Hand_make(Hand* hand, char const *text)
+#define MAX_DEAL 8
+
+// The cards of a deal, in the order they were given
+typedef struct Deal {
+    size_t num_cards;
+    Card cards[MAX_DEAL];
+} Deal;
+
+static Deal* Deal_make(Deal* deal, char const *text)
 {
-    Hand_init(hand);
+    deal->num_cards = 0;
+    bool have_rank = false;
     Rank rank = 0;
     for (char const* s = text; *s; ++s) {
         int c = toupper((unsigned char) *s);
-        switch (c) {
-        case 'H':
-        case 'C':
-        case 'S':
-        case 'D':
-            {
-                if (rank == 0)
-                    die("Malformed hand '%s'", text);
-                Card card;
-                Card_init(&card, rank, c);
-                Hand_push(hand, card);
-                rank = 0;
-            }
-            break;
-        case 'A':
-        case '2':
-        case '3':
-        case '4':
-        case '5':
-        case '6':
-        case '7':
-        case '8':
-        case '9':
-        case 'T':
-        case 'J':
-        case 'Q':
-        case 'K':
-            {
-                if (rank != 0)
-                    die("Malformed hand '%s'", text);
-                rank = c;
-            }
-            break;
-        case ' ':
-        case '-':
-            break;
-        default:
-            die("Malformed hand '%s'", text);
+        char const* r = c ? strchr(rank_chars, c) : NULL;
+        char const* u = c ? strchr(suit_chars, c) : NULL;
+        if (u) {
+            if (!have_rank || deal->num_cards == MAX_DEAL)
+                die("Malformed hand '%s'", text);
+            deal->cards[deal->num_cards++] =
+                Card_make(rank, (Suit) (u - suit_chars));
+            have_rank = false;
+        }
+        else if (r) {
+            if (have_rank)
+                die("Malformed hand '%s'", text);
+            rank = (Rank) (r - rank_chars);
+            have_rank = true;
         }
+        else if (c != ' ' && c != '-')
+            die("Malformed hand '%s'", text);
     }
-    if (rank != 0)
+    if (have_rank)
         die("Malformed hand '%s'", text);
+    return deal;
+}
+
+static Hand* Hand_make(Hand* hand, char const *text)
+{
+    Deal deal;
+    Deal_make(&deal, text);
+    Hand_init(hand);
+    for (size_t i = 0; i < deal.num_cards; ++i)
+        Hand_insert(hand, deal.cards[i]);
     return hand;
 }
 
-static void Hand_print(Hand const* this)
+static Card Card_parse(char const *text)
+{
+    Hand hand;
+    Hand_make(&hand, text);
+    assert(Hand_size(&hand) == 1);
+    return Hand_take(&hand);
+}
+
+static void Deal_print(Deal const* this, Hand const* subset)
 {
     bool sep = false;
     for (size_t i = 0; i < this->num_cards; ++i) {
+        if (!Hand_has(subset, this->cards[i]))
+            continue;
         if (sep)
             putchar(' ');
         sep = true;
-        putchar(this->cards[i].rank);
-        putchar(this->cards[i].suit);
+        Card_print(this->cards[i]);
     }
 }
 
-static int score_15s(Hand const* hand) {
-    int a = Hand_value(hand, 0);
-    int b = Hand_value(hand, 1);
-    int c = Hand_value(hand, 2);
-    int d = Hand_value(hand, 3);
-    int e = Hand_value(hand, 4);
+static int score_15s(Hand hand, Card cut)
+{
+    assert(Hand_size(&hand) == 4);
+    int a = Card_value(Hand_take(&hand));
+    int b = Card_value(Hand_take(&hand));
+    int c = Card_value(Hand_take(&hand));
+    int d = Card_value(Hand_take(&hand));
+    int e = Card_value(cut);
     int num_15s = 0;
 
     // five cards - C(5,5)=1
@@ -288,18 +259,18 @@ static int score_15s(Hand const* hand) {
     return 2 * num_15s;
 }
 
-static int score_pairs(Hand const* hand)
+static int score_pairs(Hand hand, Card cut)
 {
-    size_t n = Hand_size(hand);
-    int num_pairs = 0;
-    for (size_t i = 0; i < n - 1; ++i) {
-        Card card = Hand_card(hand, i);
-        for (size_t j = i; ++j < n;) {
-            if (card.rank == Hand_card(hand, j).rank)
-                ++num_pairs;
-        }
-    }
-
+    assert(Hand_size(&hand) == 4);
+    Rank a = Card_rank(Hand_take(&hand));
+    Rank b = Card_rank(Hand_take(&hand));
+    Rank c = Card_rank(Hand_take(&hand));
+    Rank d = Card_rank(Hand_take(&hand));
+    Rank e = Card_rank(cut);
+    int num_pairs = (a == b) + (a == c) + (a == d) + (a == e) +
+                    (b == c) + (b == d) + (b == e) +
+                    (c == d) + (c == e) +
+                    (d == e);
     return 2 * num_pairs;
 }
 
@@ -332,15 +303,15 @@ static Pattern const patterns[] = {
 };
 #define NUM_PATTERNS (sizeof(patterns) / sizeof(patterns[0]))
 
-static int score_runs(Hand const* hand)
+static int score_runs(Hand hand, Card cut)
 {
-    assert(Hand_size(hand) == 5);
+    assert(Hand_size(&hand) == 4);
 
-    // Make a sorted copy of the hand, but use only the order
-    // of each rank, ignore the suit.
+    // Make a sorted copy of the hand, but use only the rank
+    // of each card, ignore the suit.
     int orders[5];
     for (size_t i = 0; i < 5; ++i) {
-        int order = Hand_order(hand, i);
+        int order = (int) Card_rank(i < 4 ? Hand_take(&hand) : cut);
         for (size_t j = 0;; ++j) {
             if (j == i) {
                 // insert at end
@@ -376,15 +347,15 @@ static int score_runs(Hand const* hand)
     return 0;
 }
 
-static int score_flush(Hand const* hand, bool is_crib)
+static int score_flush(Hand hand, Card cut, bool is_crib)
 {
-    assert(Hand_size(hand) == 5);
-    int suit = Hand_card(hand, 0).suit;
+    assert(Hand_size(&hand) == 4);
+    Suit suit = Card_suit(Hand_take(&hand));
     for (size_t i = 1; i < 4; ++i)
-        if (suit != Hand_card(hand, i).suit)
+        if (suit != Card_suit(Hand_take(&hand)))
             return 0;
-    // first 4 are same suit
-    if (suit == Hand_card(hand, 4).suit)
+    // all 4 in the hand are the same suit
+    if (suit == Card_suit(cut))
         return 5;
     // In the crib, a flush counts only if all five cards are the same suit.
     if (is_crib)
@@ -392,42 +363,20 @@ static int score_flush(Hand const* hand, bool is_crib)
     return 4;
 }
 
-static int score_nobs(Hand const* hand)
-{
-    size_t n = Hand_size(hand);
-    assert(n != 0);
-    --n;
-    int cut_suit = Hand_card(hand, n).suit;
-    for (size_t i = 0; i < n; ++i) {
-        Card card = Hand_card(hand, i);
-        if (card.rank == 'J' && card.suit == cut_suit)
-            return 1;
-    }
-    return 0;
-}
-
-static int score_hand(Hand const* hand, bool is_crib)
+static int score_nobs(Hand hand, Card cut)
 {
-    return score_15s(hand) +
-        score_pairs(hand) +
-        score_runs(hand) +
-        score_flush(hand, is_crib) +
-        score_nobs(hand);
+    // the jack of the cut's suit
+    Card jack = Card_make(10, Card_suit(cut));
+    return Hand_has(&hand, jack);
 }
 
-static void make_deck(Hand* deck, Hand const* exclude)
+static int score_hand(Hand hand, Card cut, bool is_crib)
 {
-    static char const suits[] = "HCDS";
-    static char const ranks[] = "A23456789TJQK";
-    Hand_init(deck);
-    for (char const* suit = suits; *suit; ++suit) {
-        for (char const* rank = ranks; *rank; ++rank) {
-            Card card;
-            Card_init(&card, *rank, *suit);
-            if (!Hand_has(exclude, card))
-                Hand_push(deck, card);
-        }
-    }
+    return score_15s(hand, cut) +
+        score_pairs(hand, cut) +
+        score_runs(hand, cut) +
+        score_flush(hand, cut, is_crib) +
+        score_nobs(hand, cut);
 }
 
 #define MAX_SCORE (29 + 24)           // 29 in hand, 24 in crib (44665)
@@ -502,127 +451,205 @@ static void Statistics_print(Statistics const* this)
 }
 
 #define MAX_CHOOSE 3
+#define MAX_THREADS 256
 
+// Iterate over all the ways of choosing `num_choose` cards from a hand.
+// Each choice is a set of 1-bits of the hand, produced in increasing
+// order of the lowest differing bit.
 typedef struct Choose {
-    Hand const* hand;
+    uint64_t from;
     size_t num_choose;
-    Hand* chosen;
-    size_t i;
-    size_t i_stack_depth;
-    size_t i_stack[MAX_CHOOSE];
-    bool yielded;
+    uint64_t picks[MAX_CHOOSE]; // single 1-bits, in increasing order
+    bool started;
 } Choose;
 
-static void Choose_init(Choose* this, Hand const* hand, size_t num_choose, Hand* chosen)
+static void Choose_init(Choose* this, Hand const* hand, size_t num_choose)
 {
-    Hand_init(chosen);
-    this->hand = hand;
+    assert(num_choose > 0 && num_choose <= MAX_CHOOSE);
+    this->from = hand->cards;
     this->num_choose = num_choose;
-    this->chosen = chosen;
-    this->i = 0;
-    this->i_stack_depth = 0;
-    this->yielded = false;
+    this->started = false;
 }
 
-static bool Choose_next(Choose* this)
+// The lowest 1-bit in `bits` above `bit`
+static uint64_t next_bit(uint64_t bits, uint64_t bit)
 {
-    if (this->yielded) {
-        this->yielded = false;
-        Hand_pop(this->chosen);
-        --this->i_stack_depth;
-        assert(this->i_stack_depth >= 0 && this->i_stack_depth < MAX_CHOOSE);
-        this->i = this->i_stack[this->i_stack_depth] + 1;
-    }
+    bits &= ~(bit | (bit - 1));
+    return bits & -bits;
+}
 
-    for (;;) {
-        if (Hand_size(this->chosen) == this->num_choose) {
-            this->yielded = true;
-            return true;
-        }
-        if (this->i != Hand_size(this->hand)) {
-            Hand_push(this->chosen, Hand_card(this->hand, this->i));
-            assert(this->i_stack_depth >= 0 && this->i_stack_depth < MAX_CHOOSE);
-            this->i_stack[this->i_stack_depth] = this->i++;
-            this->i_stack_depth++;
-        }
-        else if (this->i_stack_depth > 0) {
-            Hand_pop(this->chosen);
-            this->i_stack_depth--;
-            assert(this->i_stack_depth >= 0 && this->i_stack_depth < MAX_CHOOSE);
-            this->i = this->i_stack[this->i_stack_depth] + 1;
-        }
-        else {
+static bool Choose_next(Choose* this, Hand* chosen)
+{
+    size_t const k = this->num_choose;
+    size_t i;
+    if (!this->started) {
+        this->started = true;
+        if ((size_t) __builtin_popcountll(this->from) < k)
             return false;
+        this->picks[0] = this->from & -this->from;
+        i = 0;
+    }
+    else {
+        // Advance the highest pick that has room to move up, leaving
+        // enough bits above it for the picks that follow it
+        for (i = k;;) {
+            if (i == 0)
+                return false;
+            --i;
+            uint64_t bit = next_bit(this->from, this->picks[i]);
+            if (bit && (size_t) __builtin_popcountll(this->from & ~(bit - 1)) >= k - i) {
+                this->picks[i] = bit;
+                break;
+            }
+        }
+    }
+    uint64_t cards = 0;
+    for (size_t j = 0; j < k; ++j) {
+        if (j > i)
+            this->picks[j] = next_bit(this->from, this->picks[j - 1]);
+        cards |= this->picks[j];
+    }
+    chosen->cards = cards;
+    return true;
+}
+
+/*
+  The crib pairs for each discard are split into independent pieces of
+  work, one per lowest card of the pair, so several threads can share a
+  hand.  Each piece has its own tallies, and the pieces are added up in a
+  fixed order afterwards, so the output is the same however many threads
+  there are.
+*/
+typedef struct Work {
+    Hand hold;
+    Hand discard;
+    Hand deck;
+    uint64_t low;               // the lower card of each crib pair
+    Tally mine_tally;           // scores when the crib is mine
+    Tally theirs_tally;         // scores then the crib is theirs
+    int num_hands;
+} Work;
+
+static void Work_run(Work* this)
+{
+    Tally_init(&this->mine_tally);
+    Tally_init(&this->theirs_tally);
+    this->num_hands = 0;
+
+    Hand highs = { this->deck.cards & ~(this->low | (this->low - 1)) };
+    while (Hand_size(&highs) != 0) {
+        uint64_t pair = this->low | Hand_take(&highs).bit;
+        Hand crib = { this->discard.cards | pair };
+        Hand cuts = { this->deck.cards & ~pair };
+
+        while (Hand_size(&cuts) != 0) {
+            Card cut = Hand_take(&cuts);
+
+            int hold_score = score_hand(this->hold, cut, false);
+            int crib_score = score_hand(crib, cut, true);
+
+            int mine_score = hold_score + crib_score;
+            int theirs_score = hold_score - crib_score;
+
+            ++this->num_hands;
+
+            Tally_increment(&this->mine_tally, mine_score);
+            Tally_increment(&this->theirs_tally, theirs_score);
         }
     }
 }
 
-static void analyze_hand(Hand const* hand)
+typedef struct WorkQueue {
+    Work* work;
+    size_t num_work;
+    atomic_size_t next;
+} WorkQueue;
+
+static void* WorkQueue_run(void* arg)
+{
+    WorkQueue* this = arg;
+    for (size_t i; (i = atomic_fetch_add(&this->next, 1)) < this->num_work;)
+        Work_run(&this->work[i]);
+    return NULL;
+}
+
+static void Tally_add(Tally* this, Tally const* that)
+{
+    for (size_t i = 0; i < NUM_SCORES; ++i)
+        this->scores[i] += that->scores[i];
+}
+
+static void analyze_hand(char const* text, size_t num_threads)
 {
     /*
       Find all possible pairs of cards to discard to the crib.
       There are C(6,2)=15 possible discards in a cribbage hand.
     */
+    Deal deal;
+    Deal_make(&deal, text);
+
+    Hand hand;
+    Hand_make(&hand, text);
+
     printf("[ ");
-    Hand_print(hand);
+    Deal_print(&deal, &hand);
     printf(" ]\n");
 
+    Hand deck = { ALL_CARDS & ~hand.cards };
+    assert(Hand_size(&deck) == 46);
+
+    // Choose positions in the deal rather than cards, so the discards come
+    // out in the order the cards were given
+    Hand positions = { (UINT64_C(1) << deal.num_cards) - 1 };
+    size_t const work_per_discard = Hand_size(&deck) - 1;
+    size_t const num_discards = deal.num_cards * (deal.num_cards - 1) / 2;
+    size_t const max_work = num_discards * work_per_discard;
+    WorkQueue queue = { calloc(max_work, sizeof(Work)), 0, 0 };
+    if (!queue.work)
+        die("Out of memory");
+
     Choose choose_to_discard;
-    Hand discard;
-    Choose_init(&choose_to_discard, hand, 2, &discard);
-    while (Choose_next(&choose_to_discard)) {
-        Hand hold;
-        Hand_init(&hold);
-        for (size_t i = 0; i != Hand_size(hand); ++i) {
-            Card card = Hand_card(hand, i);
-            if (!Hand_has(&discard, card))
-                Hand_push(&hold, card);
+    Hand chosen_positions;
+    Choose_init(&choose_to_discard, &positions, 2);
+    while (Choose_next(&choose_to_discard, &chosen_positions)) {
+        Hand discard;
+        Hand_init(&discard);
+        while (Hand_size(&chosen_positions) != 0)
+            Hand_insert(&discard, deal.cards[Card_index(Hand_take(&chosen_positions))]);
+
+        Hand hold = { hand.cards & ~discard.cards };
+        Hand lows = deck;
+        for (size_t i = 0; i < work_per_discard; ++i) {
+            assert(queue.num_work < max_work);
+            Work* work = &queue.work[queue.num_work++];
+            work->hold = hold;
+            work->discard = discard;
+            work->deck = deck;
+            work->low = Hand_take(&lows).bit;
         }
+    }
 
-        Hand deck;
-        make_deck(&deck, hand);
-        assert(Hand_size(&deck) == 46);
-
-        Tally mine_tally;           // scores when the crib is mine
+    pthread_t threads[MAX_THREADS];
+    size_t num_started = 0;
+    for (; num_started + 1 < num_threads; ++num_started)
+        if (pthread_create(&threads[num_started], NULL, WorkQueue_run, &queue) != 0)
+            die("Can't create thread");
+    WorkQueue_run(&queue);
+    for (size_t i = 0; i < num_started; ++i)
+        pthread_join(threads[i], NULL);
+
+    for (size_t w = 0; w < queue.num_work; w += work_per_discard) {
+        Tally mine_tally;
         Tally_init(&mine_tally);
 
-        Tally theirs_tally;         // scores then the crib is theirs
+        Tally theirs_tally;
         Tally_init(&theirs_tally);
 
         int num_hands = 0;
-        Choose choose_from_deck;
-        Hand chosen;
-        Choose_init(&choose_from_deck, &deck, 2, &chosen);
-        while (Choose_next(&choose_from_deck)) {
-            Card card1 = Hand_card(&chosen, 0);
-            Card card2 = Hand_card(&chosen, 1);
-
-            Hand crib;
-            Hand_copy(&crib, &discard);
-            Hand_push(&crib, card1);
-            Hand_push(&crib, card2);
-
-            for (size_t i = 0; i != Hand_size(&deck); ++i) {
-                Card cut = Hand_card(&deck, i);
-                if (Card_equal(cut, card1) || Card_equal(cut, card2))
-                    continue;
-
-                Hand_push(&hold, cut);
-                int hold_score = score_hand(&hold, false);
-                Hand_pop(&hold);
-
-                Hand_push(&crib, cut);
-                int crib_score = score_hand(&crib, true);
-                Hand_pop(&crib);
-
-                int mine_score = hold_score + crib_score;
-                int theirs_score = hold_score - crib_score;
-
-                ++num_hands;
-
-                Tally_increment(&mine_tally, mine_score);
-                Tally_increment(&theirs_tally, theirs_score);
-            }
+        for (size_t i = w; i < w + work_per_discard; ++i) {
+            Tally_add(&mine_tally, &queue.work[i].mine_tally);
+            Tally_add(&theirs_tally, &queue.work[i].theirs_tally);
+            num_hands += queue.work[i].num_hands;
         }
         // deck size: 46, C(46,2)=1035
         // remaining_deck size: 44
@@ -636,13 +663,14 @@ static void analyze_hand(Hand const* hand)
         Statistics if_theirs;
         Statistics_init(&if_theirs, &theirs_tally, num_hands);
 
-        Hand_print(&discard);
+        Deal_print(&deal, &queue.work[w].discard);
         printf(" [");
         Statistics_print(&if_mine);
         printf("] [");
         Statistics_print(&if_theirs);
         printf("]\n");
     }
+    free(queue.work);
 
     putchar('\n');
 }
@@ -659,60 +687,60 @@ int main(int argc __attribute__((unused)), char **argv)
 {
     Hand hand;
 
-    CHECK( 4 == score_15s(Hand_make(&hand, "AH 2H 3H JH QH")));
-    CHECK( 8 == score_15s(Hand_make(&hand, "5H 2H 3H JH QH")));
-    CHECK(16 == score_15s(Hand_make(&hand, "5H 5S 5C 5D TH")));
-    CHECK( 8 == score_15s(Hand_make(&hand, "6C 6D 4D 4S 5D")));
-
-    CHECK(12 == score_pairs(Hand_make(&hand, "5H 5S 5C 5D TH")));
-    CHECK( 8 == score_pairs(Hand_make(&hand, "TS 5S 5C 5D TH")));
-    CHECK( 4 == score_pairs(Hand_make(&hand, "6C 6D 4D 4S 5D")));
-
-    CHECK( 9 == score_runs(Hand_make(&hand, "AH 2H 3H 3D 3C")));
-    CHECK( 9 == score_runs(Hand_make(&hand, "KH KD KC JH QH")));  // same pattern A2333
-    CHECK( 9 == score_runs(Hand_make(&hand, "AH 2H 2D 2C 3H")));
-    CHECK( 9 == score_runs(Hand_make(&hand, "AH AD AC 2H 3H")));
-    CHECK( 8 == score_runs(Hand_make(&hand, "AH 2H 3H 4H 4D")));
-    CHECK( 8 == score_runs(Hand_make(&hand, "AH 2H 3H 3D 4H")));
-    CHECK( 8 == score_runs(Hand_make(&hand, "AH 2H 2C 3H 4H")));
-    CHECK( 8 == score_runs(Hand_make(&hand, "AS AH 2H 3H 4H")));
-    CHECK( 6 == score_runs(Hand_make(&hand, "JH AH 2H 3D 3H")));
-    CHECK( 6 == score_runs(Hand_make(&hand, "JH AH 2S 2H 3H")));
-    CHECK( 6 == score_runs(Hand_make(&hand, "JH AH AS 2H 3H")));
-    CHECK( 6 == score_runs(Hand_make(&hand, "AH 2H 3S 3H JH")));
-    CHECK( 6 == score_runs(Hand_make(&hand, "AH 2H 2S 3H JH")));
-    CHECK( 6 == score_runs(Hand_make(&hand, "AH AS 2H 3H JH")));
-    CHECK( 5 == score_runs(Hand_make(&hand, "AH 2H 3H 4H 5H")));
-    CHECK( 4 == score_runs(Hand_make(&hand, "JH AH 2H 3H 4H")));
-    CHECK( 4 == score_runs(Hand_make(&hand, "AH 2H 3H 4H JH")));
-    CHECK( 3 == score_runs(Hand_make(&hand, "JH QH AH 2H 3H")));
-    CHECK( 3 == score_runs(Hand_make(&hand, "JH AH 2H 3H TH")));
-    CHECK( 3 == score_runs(Hand_make(&hand, "AH 2H 3H JH TH")));
-    CHECK( 0 == score_runs(Hand_make(&hand, "AH 8H 3H JH TH")));
-    CHECK(12 == score_runs(Hand_make(&hand, "6C 6D 4D 4S 5D")));
-
-    CHECK( 5 == score_flush(Hand_make(&hand, "5H 6H 7H 8H 9H"), false));
-    CHECK( 4 == score_flush(Hand_make(&hand, "5H 6H 7H 8H 9D"), false));
-    CHECK( 0 == score_flush(Hand_make(&hand, "5H 6H 7H 8H 9D"), true));
-    CHECK( 0 == score_flush(Hand_make(&hand, "5H 6H 7H 8D 9D"), false));
-
-    CHECK( 1 == score_nobs(Hand_make(&hand, "JH 2C 3C 4C 5H")));
-    CHECK( 0 == score_nobs(Hand_make(&hand, "JH 2C 3C 4C 5C")));
-
-    CHECK(12 == score_hand(Hand_make(&hand, "AH AS JH AC AD"), false)); // 4oak ("of a kind")
-    CHECK(13 == score_hand(Hand_make(&hand, "AH AS JD AC AD"), false)); // ...plus right jack
-    CHECK( 5 == score_hand(Hand_make(&hand, "AH 3H 7H TH JH"), false)); // 5 hearts
-    CHECK( 5 == score_hand(Hand_make(&hand, "AH 3H 7H TH JH"), true));  // 5 hearts but crib
-    CHECK( 4 == score_hand(Hand_make(&hand, "AH 3H 7H TH JS"), false)); // 4 hearts
-    CHECK( 0 == score_hand(Hand_make(&hand, "AH 3H 7S TH JH"), false)); // 4 hearts but with cut
-    CHECK( 0 == score_hand(Hand_make(&hand, "AH 3H 7H TH JS"), true));  // 4 hearts but crib
-    CHECK( 7 == score_hand(Hand_make(&hand, "AH 2S 3C 5D JH"), false)); // 15/4 + run/3
-    CHECK(20 == score_hand(Hand_make(&hand, "7H 7S 7C 8D 8H"), false)); // 15/12 + 3oak + 2oak
-    CHECK(15 == score_hand(Hand_make(&hand, "AH 2H 3H 3S 3D"), false)); // triple run/3
-    CHECK(15 == score_hand(Hand_make(&hand, "3H AH 3S 2H 3D"), false)); // triple run/3
-    CHECK(29 == score_hand(Hand_make(&hand, "5H 5C 5S JD 5D"), false));
-    CHECK(28 == score_hand(Hand_make(&hand, "5H 5C 5S 5D JD"), false));
-    CHECK(24 == score_hand(Hand_make(&hand, "6C 4D 6D 4S 5D"), false));
+    CHECK( 4 == score_15s(*Hand_make(&hand, "AH 2H 3H JH"), Card_parse("QH")));
+    CHECK( 8 == score_15s(*Hand_make(&hand, "5H 2H 3H JH"), Card_parse("QH")));
+    CHECK(16 == score_15s(*Hand_make(&hand, "5H 5S 5C 5D"), Card_parse("TH")));
+    CHECK( 8 == score_15s(*Hand_make(&hand, "6C 6D 4D 4S"), Card_parse("5D")));
+
+    CHECK(12 == score_pairs(*Hand_make(&hand, "5H 5S 5C 5D"), Card_parse("TH")));
+    CHECK( 8 == score_pairs(*Hand_make(&hand, "TS 5S 5C 5D"), Card_parse("TH")));
+    CHECK( 4 == score_pairs(*Hand_make(&hand, "6C 6D 4D 4S"), Card_parse("5D")));
+
+    CHECK( 9 == score_runs(*Hand_make(&hand, "AH 2H 3H 3D"), Card_parse("3C")));
+    CHECK( 9 == score_runs(*Hand_make(&hand, "KH KD KC JH"), Card_parse("QH")));  // same pattern A2333
+    CHECK( 9 == score_runs(*Hand_make(&hand, "AH 2H 2D 2C"), Card_parse("3H")));
+    CHECK( 9 == score_runs(*Hand_make(&hand, "AH AD AC 2H"), Card_parse("3H")));
+    CHECK( 8 == score_runs(*Hand_make(&hand, "AH 2H 3H 4H"), Card_parse("4D")));
+    CHECK( 8 == score_runs(*Hand_make(&hand, "AH 2H 3H 3D"), Card_parse("4H")));
+    CHECK( 8 == score_runs(*Hand_make(&hand, "AH 2H 2C 3H"), Card_parse("4H")));
+    CHECK( 8 == score_runs(*Hand_make(&hand, "AS AH 2H 3H"), Card_parse("4H")));
+    CHECK( 6 == score_runs(*Hand_make(&hand, "JH AH 2H 3D"), Card_parse("3H")));
+    CHECK( 6 == score_runs(*Hand_make(&hand, "JH AH 2S 2H"), Card_parse("3H")));
+    CHECK( 6 == score_runs(*Hand_make(&hand, "JH AH AS 2H"), Card_parse("3H")));
+    CHECK( 6 == score_runs(*Hand_make(&hand, "AH 2H 3S 3H"), Card_parse("JH")));
+    CHECK( 6 == score_runs(*Hand_make(&hand, "AH 2H 2S 3H"), Card_parse("JH")));
+    CHECK( 6 == score_runs(*Hand_make(&hand, "AH AS 2H 3H"), Card_parse("JH")));
+    CHECK( 5 == score_runs(*Hand_make(&hand, "AH 2H 3H 4H"), Card_parse("5H")));
+    CHECK( 4 == score_runs(*Hand_make(&hand, "JH AH 2H 3H"), Card_parse("4H")));
+    CHECK( 4 == score_runs(*Hand_make(&hand, "AH 2H 3H 4H"), Card_parse("JH")));
+    CHECK( 3 == score_runs(*Hand_make(&hand, "JH QH AH 2H"), Card_parse("3H")));
+    CHECK( 3 == score_runs(*Hand_make(&hand, "JH AH 2H 3H"), Card_parse("TH")));
+    CHECK( 3 == score_runs(*Hand_make(&hand, "AH 2H 3H JH"), Card_parse("TH")));
+    CHECK( 0 == score_runs(*Hand_make(&hand, "AH 8H 3H JH"), Card_parse("TH")));
+    CHECK(12 == score_runs(*Hand_make(&hand, "6C 6D 4D 4S"), Card_parse("5D")));
+
+    CHECK( 5 == score_flush(*Hand_make(&hand, "5H 6H 7H 8H"), Card_parse("9H"), false));
+    CHECK( 4 == score_flush(*Hand_make(&hand, "5H 6H 7H 8H"), Card_parse("9D"), false));
+    CHECK( 0 == score_flush(*Hand_make(&hand, "5H 6H 7H 8H"), Card_parse("9D"), true));
+    CHECK( 0 == score_flush(*Hand_make(&hand, "5H 6H 7H 8D"), Card_parse("9D"), false));
+
+    CHECK( 1 == score_nobs(*Hand_make(&hand, "JH 2C 3C 4C"), Card_parse("5H")));
+    CHECK( 0 == score_nobs(*Hand_make(&hand, "JH 2C 3C 4C"), Card_parse("5C")));
+
+    CHECK(12 == score_hand(*Hand_make(&hand, "AH AS JH AC"), Card_parse("AD"), false)); // 4oak ("of a kind")
+    CHECK(13 == score_hand(*Hand_make(&hand, "AH AS JD AC"), Card_parse("AD"), false)); // ...plus right jack
+    CHECK( 5 == score_hand(*Hand_make(&hand, "AH 3H 7H TH"), Card_parse("JH"), false)); // 5 hearts
+    CHECK( 5 == score_hand(*Hand_make(&hand, "AH 3H 7H TH"), Card_parse("JH"), true));  // 5 hearts but crib
+    CHECK( 4 == score_hand(*Hand_make(&hand, "AH 3H 7H TH"), Card_parse("JS"), false)); // 4 hearts
+    CHECK( 0 == score_hand(*Hand_make(&hand, "AH 3H 7S TH"), Card_parse("JH"), false)); // 4 hearts but with cut
+    CHECK( 0 == score_hand(*Hand_make(&hand, "AH 3H 7H TH"), Card_parse("JS"), true));  // 4 hearts but crib
+    CHECK( 7 == score_hand(*Hand_make(&hand, "AH 2S 3C 5D"), Card_parse("JH"), false)); // 15/4 + run/3
+    CHECK(20 == score_hand(*Hand_make(&hand, "7H 7S 7C 8D"), Card_parse("8H"), false)); // 15/12 + 3oak + 2oak
+    CHECK(15 == score_hand(*Hand_make(&hand, "AH 2H 3H 3S"), Card_parse("3D"), false)); // triple run/3
+    CHECK(15 == score_hand(*Hand_make(&hand, "3H AH 3S 2H"), Card_parse("3D"), false)); // triple run/3
+    CHECK(29 == score_hand(*Hand_make(&hand, "5H 5C 5S JD"), Card_parse("5D"), false));
+    CHECK(28 == score_hand(*Hand_make(&hand, "5H 5C 5S 5D"), Card_parse("JD"), false));
+    CHECK(24 == score_hand(*Hand_make(&hand, "6C 4D 6D 4S"), Card_parse("5D"), false));
 
     {
         Tally t = {
@@ -731,6 +759,19 @@ int main(int argc __attribute__((unused)), char **argv)
         CHECK(strcmp(buf, "22.9 0.8 16..53") == 0);
     }
 
-    while (*++argv)
-        analyze_hand(Hand_make(&hand, *argv));
+    // -j N to use N threads
+    size_t num_threads = 1;
+    while (*++argv) {
+        char const* arg = *argv;
+        if (strncmp(arg, "-j", 2) == 0) {
+            char const* n = arg[2] ? arg + 2 : *++argv;
+            if (!n || !isdigit((unsigned char) *n))
+                die("Expected a number of threads after -j");
+            num_threads = strtoul(n, NULL, 10);
+            if (num_threads < 1 || num_threads > MAX_THREADS)
+                die("The number of threads must be 1 to %d", MAX_THREADS);
+            continue;
+        }
+        analyze_hand(arg, num_threads);
+    }
 }
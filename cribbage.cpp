@@ -8,18 +8,47 @@
 */
 
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <charconv>
+#include <condition_variable>
+#include <cerrno>
 #include <cmath>
 #include <cstddef>
+#include <cstdio>
+#include <exception>
+#include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <optional>
+#include <queue>
+#include <span>
+#include <sstream>
 #include <stdexcept>
 #include <utility>
+#include <vector>
 #include <cstring>
+#include <string>
 #include <string_view>
+#include <thread>
+#include <tuple>
 #include <type_traits>
 #include <bit>
 
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #if 0 // 1 to facilitate constexpr/static_assert debugging
 #  define constexpr
 #  define token_paste_(A, B) A ## B
@@ -87,24 +116,48 @@ public:
 
 };
 
-constexpr Rank rank_from_char(char c) noexcept {
-  // std::strchr is not constexpr
-  for (const char* p = rank_chars;; ++p) {
-    if (*p == c)
-      return p - rank_chars;
-    assert(*p != '\0');
+/* What each byte means in a hand, looked up rather than searched for: the
+   high bits say whether it's a rank, a suit, a separator or none of those,
+   and the low bits which rank or suit.  Lower case works too. */
+constexpr uint8_t char_rank = 0x10;
+constexpr uint8_t char_suit = 0x20;
+constexpr uint8_t char_separator = 0x40;
+constexpr uint8_t char_invalid = 0x80;
+
+constexpr std::array<uint8_t, 256> char_classes = [] {
+  auto to_lower = [](char c) -> uint8_t { // std::tolower is not constexpr
+    return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+  };
+  std::array<uint8_t, 256> classes{};
+  classes.fill(char_invalid);
+  for (uint8_t r = 0; r < num_ranks; ++r) {
+    classes[uint8_t(rank_chars[r])] = char_rank | r;
+    classes[to_lower(rank_chars[r])] = char_rank | r;
   }
+  for (uint8_t s = 0; s < num_suits; ++s) {
+    classes[uint8_t(suit_chars[s])] = char_suit | s;
+    classes[to_lower(suit_chars[s])] = char_suit | s;
+  }
+  for (char c : {' ', '-', '\t', '\r'})
+    classes[uint8_t(c)] = char_separator;
+  return classes;
+}();
+
+constexpr Rank rank_from_char(char c) noexcept {
+  auto k = char_classes[uint8_t(c)];
+  assert(k & char_rank);
+  return k & 0xf;
 }
 
 constexpr Suit suit_from_char(char c) noexcept {
-  // std::strchr is not constexpr
-  for (const char* p = suit_chars;; ++p) {
-    if (*p == c)
-      return p - suit_chars;
-    assert(*p != '\0');
-  }
+  auto k = char_classes[uint8_t(c)];
+  assert(k & char_suit);
+  return k & 0xf;
 }
 
+static_assert(rank_from_char('K') == 12 && rank_from_char('t') == 9);
+static_assert(suit_from_char('H') == 3 && suit_from_char('d') == 1);
+
 constexpr Card make_card(char rank, char suit)
 {
   return Card{rank_from_char(rank), suit_from_char(suit)};
@@ -138,6 +191,14 @@ public:
     return std::popcount(cards_);
   }
 
+  constexpr uint64_t bits() const noexcept {
+    return cards_;
+  }
+
+  constexpr bool overlaps(Hand other) const noexcept {
+    return (cards_ & other.cards_) != 0;
+  }
+
   constexpr bool has(Card card) const noexcept {
     return (cards_ & card.card_) != 0;
   }
@@ -147,6 +208,11 @@ public:
     cards_ |= card.card_;
   }
 
+  constexpr void insert(Hand other) noexcept {
+    assert((cards_ & other.cards_) == 0);
+    cards_ |= other.cards_;
+  }
+
   constexpr void remove(Card card) noexcept {
     assert(has(card));
     cards_ &= ~card.card_;
@@ -172,6 +238,7 @@ public:
 constexpr Hand all_cards{0x1fff'1fff'1fff'1fff};
 static_assert(all_cards.size() == 52);
 
+[[maybe_unused]]
 std::ostream &operator<<(std::ostream &os, Hand hand) {
   bool sep = false;
   while (auto card = hand.take()) {
@@ -183,61 +250,143 @@ std::ostream &operator<<(std::ostream &os, Hand hand) {
   return os;
 }
 
-constexpr char to_upper(char c) noexcept { // std::toupper is not constexpr
-    if (c >= 'a' && c <= 'z')
-        return c - 'a' + 'A';
-    return c;
-}
-
-constexpr bool is_space(char c) noexcept { // std::isspace is not constexpr
-    return c == ' ';
-}
+// Why a line isn't a hand
+enum class HandError : uint8_t {
+  none, empty, bad_char, missing_rank, missing_suit, duplicate_card, wrong_size,
+};
+constexpr std::string_view hand_error_names[] = {
+  "ok", "empty", "unexpected character", "suit without a rank",
+  "rank without a suit", "duplicate card", "wrong number of cards",
+};
 
-constexpr Hand make_hand(std::string_view str) {
-  Hand h;
-  char rank_char = 0;
+/* Cards are a rank then a suit, like "5H", separated by any number of
+   spaces or dashes (or neither).  No allocation and no exceptions, so it
+   can chew through a file of millions of hands.  A hand has no order, so
+   `last`, if given, is set to the last card written, as for a cut. */
+constexpr HandError parse_hand(std::string_view str, Hand &hand, Card *last = nullptr) noexcept {
+  hand = Hand{};
+  unsigned rank = num_ranks; // none yet
   for (auto c : str) {
-    c = to_upper(c);
-    switch (c) {
-    case 'H':
-    case 'C':
-    case 'S':
-    case 'D':
-      if (rank_char == 0)
-        throw std::runtime_error("Malformed hand '" + std::string(str) + '\'');
-      h.insert(make_card(rank_char, c));
-      rank_char = 0;
-      break;
-    case 'A':
-    case '2':
-    case '3':
-    case '4':
-    case '5':
-    case '6':
-    case '7':
-    case '8':
-    case '9':
-    case 'T':
-    case 'J':
-    case 'Q':
-    case 'K':
-      if (rank_char != 0)
-        throw std::runtime_error("Malformed hand '" + std::string(str) + '\'');
-      rank_char = c;
-      break;
-    case '-':
-      break;
-    default:
-      if (is_space(c))
-        break;
-      throw std::runtime_error("Malformed hand '" + std::string(str) + '\'');
+    auto k = char_classes[uint8_t(c)];
+    if (k & char_rank) {
+      if (rank != num_ranks)
+        return HandError::missing_suit;
+      rank = k & 0xf;
+    }
+    else if (k & char_suit) {
+      if (rank == num_ranks)
+        return HandError::missing_rank;
+      Card card{rank, Suit(k & 0xf)};
+      if (hand.has(card))
+        return HandError::duplicate_card;
+      hand.insert(card);
+      if (last)
+        *last = card;
+      rank = num_ranks;
     }
+    else if (k & char_invalid)
+      return HandError::bad_char;
   }
-  if (rank_char != 0)
-      throw std::runtime_error("Malformed hand '" + std::string(str) + '\'');
+  if (rank != num_ranks)
+    return HandError::missing_suit;
+  return hand.size() == 0 ? HandError::empty : HandError::none;
+}
+
+constexpr Hand make_hand(std::string_view str, Card *last = nullptr) {
+  Hand h;
+  if (auto error = parse_hand(str, h, last); error != HandError::none && error != HandError::empty)
+    throw std::runtime_error("Malformed hand '" + std::string(str) + "': " +
+                             std::string(hand_error_names[size_t(error)]));
   return h;
 }
 
+struct ParseResult {
+  size_t lines; // hands and errors filled in
+  size_t bytes; // of `text` used, always whole lines
+};
+
+/* Parse one hand of `deal_size` cards per line of `text` into `hands`, with
+   `errors` saying which lines aren't.  Stops at the end of the text or when
+   `hands` is full, so a big buffer can be parsed a block at a time. */
+constexpr ParseResult parse_hands(std::string_view text, size_t deal_size,
+                                  std::span<Hand> hands,
+                                  std::span<HandError> errors) noexcept {
+  assert(hands.size() == errors.size());
+  size_t line = 0;
+  size_t pos = 0;
+  while (pos < text.size() && line < hands.size()) {
+    auto end = std::min(text.find('\n', pos), text.size());
+    auto error = parse_hand(text.substr(pos, end - pos), hands[line]);
+    if (error == HandError::none && hands[line].size() != deal_size)
+      error = HandError::wrong_size;
+    errors[line++] = error;
+    pos = std::min(end + 1, text.size());
+  }
+  return {line, pos};
+}
+
+static_assert([] {
+  Hand hands[7];
+  HandError errors[7];
+  auto [lines, bytes] = parse_hands("5h-5c-5s-jd\nAS 2S 3S X4\n\n5S5D5C5H\n"
+                                    "4C\n4C 4C 2D 3D\nKH QH JH\n",
+                                    4, hands, errors);
+  return lines == 7 && bytes == 58 &&
+         hands[0].bits() == make_hand("5H 5C 5S JD").bits() &&
+         errors[0] == HandError::none &&
+         errors[1] == HandError::bad_char &&
+         errors[2] == HandError::empty &&
+         errors[3] == HandError::none &&
+         errors[4] == HandError::wrong_size &&
+         errors[5] == HandError::duplicate_card &&
+         errors[6] == HandError::wrong_size;
+}());
+
+static_assert([] {
+  Card last;
+  auto const hand = make_hand("5H-5C-5S-JD 4D- ", &last);
+  auto const four = make_card("4D");
+  return hand.size() == 5 && last.rank() == four.rank() && last.suit() == four.suit();
+}());
+
+// C(n,k), the number of choices `for_each_choice` makes
+constexpr int num_combinations(size_t n, size_t k) {
+  if (k > n)
+    return 0;
+  long result = 1;
+  for (size_t i = 1; i <= k; ++i)
+    result = result * (n - k + i) / i;
+  return result;
+}
+
+static_assert(num_combinations(6, 2) == 15);
+static_assert(num_combinations(52, 4) == 270725);
+
+/* With -DCRIBBAGE_COUNTERS (make COUNTERS=1), the scorers count how often
+   they're called and which way their branches go, per thread, and
+   `analyze_hand` reports them for each discard on std::clog.  Without it,
+   COUNT is nothing at all. */
+#ifdef CRIBBAGE_COUNTERS
+struct ScorerCounters {
+  uint64_t hands;         // score_hand calls for a hand...
+  uint64_t cribs;         // ...and for a crib
+  uint64_t generic;       // score_hand_generic calls
+  uint64_t subsets;       // of the cards checked for 15, 26 per hand...
+  uint64_t fifteens;      // ...and those that add up to 15
+  uint64_t pair_checks;   // pairs of cards compared, 10 per hand...
+  uint64_t pairs;         // ...and those that match
+  uint64_t patterns;      // run_patterns tried
+  uint64_t runs[23];      // which of run_patterns matched, then none
+  uint64_t flushes[6];    // which way score_flush returned, see flush_exits
+  uint64_t nobs;          // hands with the right jack
+};
+thread_local ScorerCounters scorer_counters;
+#  define COUNT(COUNTER, N) \
+     (std::is_constant_evaluated() ? void() : void(scorer_counters.COUNTER += (N)))
+#else
+#  define COUNT(COUNTER, N) void()
+#endif
+
 constexpr int score_15s(Hand hand, Card cut) {
   assert(hand.size() == 4);
   auto a = hand.take().value();
@@ -286,6 +435,7 @@ constexpr int score_15s(Hand hand, Card cut) {
     ++num_15s;
 
   // two cards - C(5,2)=10
+  COUNT(subsets, 26);
   if (a + b == 15)
     ++num_15s;
   if (a + c == 15)
@@ -307,6 +457,7 @@ constexpr int score_15s(Hand hand, Card cut) {
   if (d + e == 15)
     ++num_15s;
 
+  COUNT(fifteens, num_15s);
   return 2 * num_15s;
 }
 
@@ -348,6 +499,8 @@ constexpr int score_pairs(Hand hand, Card cut) {
   if (d == e)
     ++num_pairs;
 
+  COUNT(pair_checks, 10);
+  COUNT(pairs, num_pairs);
   return 2 * num_pairs;
 }
 
@@ -355,6 +508,42 @@ static_assert(12 == score_pairs(make_hand("5H 5S 5C 5D"), make_card("TH")));
 static_assert(8 == score_pairs(make_hand("TS 5S 5C 5D"), make_card("TH")));
 static_assert(4 == score_pairs(make_hand("6C 6D 4D 4S"), make_card("5D")));
 
+constexpr unsigned X = 99; // in run_patterns, match any rank
+
+// The shapes of run that score_runs recognizes, from best to worst
+constexpr struct {
+  int score;
+  unsigned delta[4];    // between each sorted rank and the next
+  std::string_view name;
+} run_patterns[] = {
+  { 12, { 0, 1, 1, 0 }, "AA233" },
+  { 12, { 1, 0, 1, 0 }, "A2233" },
+  { 12, { 0, 1, 0, 1 }, "AA223" },
+  {  9, { 1, 1, 0, 0 }, "A2333" },
+  {  9, { 1, 0, 0, 1 }, "A2223" },
+  {  9, { 0, 0, 1, 1 }, "AAA23" },
+  {  8, { 1, 1, 1, 0 }, "A2344" },
+  {  8, { 1, 1, 0, 1 }, "A2334" },
+  {  8, { 1, 0, 1, 1 }, "A2234" },
+  {  8, { 0, 1, 1, 1 }, "AA234" },
+  {  6, { X, 1, 1, 0 }, "xA233" },
+  {  6, { X, 1, 0, 1 }, "xA223" },
+  {  6, { X, 0, 1, 1 }, "xAA23" },
+  {  6, { 1, 1, 0, X }, "A233x" },
+  {  6, { 1, 0, 1, X }, "A223x" },
+  {  6, { 0, 1, 1, X }, "AA23x" },
+  {  5, { 1, 1, 1, 1 }, "A2345" },
+  {  4, { X, 1, 1, 1 }, "xA234" },
+  {  4, { 1, 1, 1, X }, "A234x" },
+  {  3, { X, X, 1, 1 }, "xxA23" },
+  {  3, { X, 1, 1, X }, "xA23x" },
+  {  3, { 1, 1, X, X }, "A23xx" },
+};
+
+#ifdef CRIBBAGE_COUNTERS
+static_assert(std::size(run_patterns) + 1 == std::size(ScorerCounters{}.runs));
+#endif
+
 constexpr int score_runs(Hand hand, Card cut) {
   assert(hand.size() == 4);
 
@@ -369,37 +558,14 @@ constexpr int score_runs(Hand hand, Card cut) {
   };
   std::sort(std::begin(ranks), std::end(ranks));
 
-  constexpr unsigned X = 99; // match any rank
-  constexpr struct {
-    int score;
-    unsigned delta[4];
-  } const patterns[] = {
-    { 12, { 0, 1, 1, 0 } }, // AA233
-    {  9, { 1, 1, 0, 0 } }, // A2333
-    {  9, { 1, 0, 0, 1 } }, // A2223
-    {  9, { 0, 0, 1, 1 } }, // AAA23
-    {  8, { 1, 1, 1, 0 } }, // A2344
-    {  8, { 1, 1, 0, 1 } }, // A2334
-    {  8, { 1, 0, 1, 1 } }, // A2234
-    {  8, { 0, 1, 1, 1 } }, // AA234
-    {  6, { X, 1, 1, 0 } }, // xA233
-    {  6, { X, 1, 0, 1 } }, // xA223
-    {  6, { X, 0, 1, 1 } }, // xAA23
-    {  6, { 1, 1, 0, X } }, // A233x
-    {  6, { 1, 0, 1, X } }, // A223x
-    {  6, { 0, 1, 1, X } }, // AA23x
-    {  5, { 1, 1, 1, 1 } }, // A2345
-    {  4, { X, 1, 1, 1 } }, // xA234
-    {  4, { 1, 1, 1, X } }, // A234x
-    {  3, { X, X, 1, 1 } }, // xxA23
-    {  3, { X, 1, 1, X } }, // xA23x
-    {  3, { 1, 1, X, X } }, // A23xx
-  };
-  for (auto& pattern : patterns) {
+  for (auto& pattern : run_patterns) {
+    COUNT(patterns, 1);
     auto previous = ranks[0];
     for (size_t j = 0;; ++j) {
-      if (j == 4)
+      if (j == 4) {
+        COUNT(runs[&pattern - run_patterns], 1);
         return pattern.score;
+      }
       auto delta = pattern.delta[j];
       auto rank = ranks[j + 1];
       if (delta != X && delta != rank - previous)
@@ -408,9 +574,12 @@ constexpr int score_runs(Hand hand, Card cut) {
     }
   }
 
+  COUNT(runs[std::size(run_patterns)], 1);
   return 0;
 }
 
+static_assert(12 == score_runs(make_hand("AH 2H 2D 3H"), make_card("3D")));
+static_assert(12 == score_runs(make_hand("AH AD 2H 2D"), make_card("3H")));
 static_assert(9 == score_runs(make_hand("AH 2H 3H 3D"), make_card("3C")));
 static_assert(9 == score_runs(make_hand("KH KD KC JH"), make_card("QH")));  // same pattern A2333
 static_assert(9 == score_runs(make_hand("AH 2H 2D 2C"), make_card("3H")));
@@ -442,24 +611,39 @@ constexpr int score_flush(Hand hand, Card cut, bool is_crib) {
   auto d = hand.take().suit();
   auto e = cut.suit();
 
-  if (a != b)
+  if (a != b) {
+    COUNT(flushes[0], 1);
     return 0;
-  if (a != c)
+  }
+  if (a != c) {
+    COUNT(flushes[1], 1);
     return 0;
-  if (a != d)
+  }
+  if (a != d) {
+    COUNT(flushes[2], 1);
     return 0;
+  }
 
   // All 4 cards in `hand` are the same suit
 
-  if (a == e)
+  if (a == e) {
+    COUNT(flushes[3], 1);
     return 5;
+  }
 
   // In the crib, a flush counts only if all five cards are the same suit.
-  if (is_crib)
+  if (is_crib) {
+    COUNT(flushes[4], 1);
     return 0;
+  }
+  COUNT(flushes[5], 1);
   return 4;
 }
 
+constexpr std::string_view flush_exits[] = {
+  "first-second", "first-third", "first-fourth", "five", "crib-four", "four",
+};
+
 static_assert(5 == score_flush(make_hand("5H 6H 7H 8H"), make_card("9H"), false));
 static_assert(4 == score_flush(make_hand("5H 6H 7H 8H"), make_card("9D"), false));
 static_assert(0 == score_flush(make_hand("5H 6H 7H 8H"), make_card("9D"), true));
@@ -472,20 +656,28 @@ constexpr int score_nobs(Hand hand, Card cut) noexcept {
   constexpr Rank jack = 10;
 
   auto a = hand.take();
-  if (a.rank() == jack && a.suit() == suit)
+  if (a.rank() == jack && a.suit() == suit) {
+    COUNT(nobs, 1);
     return 1;
+  }
 
   auto b = hand.take();
-  if (b.rank() == jack && b.suit() == suit)
+  if (b.rank() == jack && b.suit() == suit) {
+    COUNT(nobs, 1);
     return 1;
+  }
 
   auto c = hand.take();
-  if (c.rank() == jack && c.suit() == suit)
+  if (c.rank() == jack && c.suit() == suit) {
+    COUNT(nobs, 1);
     return 1;
+  }
 
   auto d = hand.take();
-  if (d.rank() == jack && d.suit() == suit)
+  if (d.rank() == jack && d.suit() == suit) {
+    COUNT(nobs, 1);
     return 1;
+  }
 
   return 0;
 }
@@ -493,7 +685,8 @@ constexpr int score_nobs(Hand hand, Card cut) noexcept {
 static_assert(1 == score_nobs(make_hand("JH 2C 3C 4C"), make_card("5H")));
 static_assert(0 == score_nobs(make_hand("JH 2C 3C 4C"), make_card("5C")));
 
-constexpr int score_hand(Hand hand, Card cut, bool is_crib) {
+// The score straight from the rules, one kind of point at a time
+constexpr int score_hand_direct(Hand hand, Card cut, bool is_crib) {
   return score_15s(hand, cut) +
          score_pairs(hand, cut) +
          score_runs(hand, cut) +
@@ -501,6 +694,124 @@ constexpr int score_hand(Hand hand, Card cut, bool is_crib) {
          score_nobs(hand, cut);
 }
 
+/* 15s, pairs and runs depend only on the five ranks, and there are just
+   C(17,5) = 6,188 multisets of five ranks, so those points come from a
+   6KB table that stays in L1 cache.  It's indexed by the combinatorial
+   number of the sorted ranks: adding i to the i'th smallest rank makes them
+   distinct, and then the usual ranking of combinations numbers them
+   densely.  Flush and nobs are bit tests on the hand. */
+constexpr size_t num_rank_multisets = num_combinations(num_ranks + 4, 5);
+
+// multiset_terms[i][r] = C(r + i, i + 1), the i'th smallest rank's term
+constexpr auto multiset_terms = [] {
+  std::array<std::array<uint16_t, num_ranks>, 5> terms{};
+  for (size_t i = 0; i < 5; ++i)
+    for (size_t r = 0; r < num_ranks; ++r)
+      terms[i][r] = uint16_t(num_combinations(r + i, i + 1));
+  return terms;
+}();
+
+constexpr size_t rank_multiset_index(Rank const (&sorted)[5]) {
+  return multiset_terms[0][sorted[0]] + multiset_terms[1][sorted[1]] +
+         multiset_terms[2][sorted[2]] + multiset_terms[3][sorted[3]] +
+         multiset_terms[4][sorted[4]];
+}
+
+constexpr size_t rank_multiset_index(Hand hand, Card cut) {
+  Rank r[] = {
+    hand.take().rank(),
+    hand.take().rank(),
+    hand.take().rank(),
+    hand.take().rank(),
+    cut.rank(),
+  };
+  // A sorting network, so there are no data-dependent branches
+  auto order = [&](size_t a, size_t b) {
+    auto lo = std::min(r[a], r[b]);
+    r[b] = std::max(r[a], r[b]);
+    r[a] = lo;
+  };
+  order(0, 1); order(3, 4); order(2, 4); order(2, 3); order(1, 4);
+  order(0, 3); order(0, 2); order(1, 3); order(1, 2);
+  return rank_multiset_index(r);
+}
+
+/* The table is built at compile time, where the scorers above are too
+   slow to call 6,188 times, so it counts 15s, pairs and runs from the ranks
+   alone, adding one rank at a time so that multisets sharing their smaller
+   ranks share that work.  The unit tests check every entry against the
+   scorers above. */
+struct RankPoints {
+  int ways[16] = {1}; // ways[t] is the number of subsets adding up to t
+  int count[num_ranks] = {};
+  unsigned present = 0;
+  int pairs = 0;
+
+  constexpr void add(Rank rank) {
+    for (int t = 15, value = std::min(int(rank) + 1, 10); t >= value; --t)
+      ways[t] += ways[t - value];
+    pairs += 2 * count[rank]++;
+    present |= 1u << rank;
+  }
+
+  constexpr int points() const {
+    // Five cards hold at most one run of three or more
+    auto const run3 = present & present >> 1 & present >> 2;
+    auto const run = run3 | run3 << 1 | run3 << 2;
+    int length = std::popcount(run);
+    int times = 1;
+    for (auto bits = run; bits; bits &= bits - 1)
+      times *= count[std::countr_zero(bits)];
+    return 2 * ways[15] + pairs + length * times;
+  }
+};
+
+constexpr void fill_rank_points(std::array<uint8_t, num_rank_multisets> &table,
+                                RankPoints const &partial, Rank (&ranks)[5],
+                                size_t n) {
+  if (n == 5) {
+    table[rank_multiset_index(ranks)] = uint8_t(partial.points());
+    return;
+  }
+  for (ranks[n] = n ? ranks[n - 1] : 0; ranks[n] < num_ranks; ++ranks[n]) {
+    auto next = partial;
+    next.add(ranks[n]);
+    fill_rank_points(table, next, ranks, n + 1);
+  }
+}
+
+constexpr auto rank_points = [] {
+  std::array<uint8_t, num_rank_multisets> table{};
+  Rank ranks[5];
+  fill_rank_points(table, RankPoints{}, ranks, 0);
+  return table;
+}();
+
+constexpr int score_suits(Hand hand, Card cut, bool is_crib) {
+  constexpr uint64_t jacks = 0x0400'0400'0400'0400;
+  auto const cards = hand.bits();
+  auto const cut_suit = uint64_t(0x1fff) << 16 * cut.suit();
+  auto const first_suit = uint64_t(0x1fff) << (std::countr_zero(cards) & ~15);
+  int flush = (cards & ~cut_suit) == 0   ? 5
+            : is_crib                    ? 0
+            : (cards & ~first_suit) == 0 ? 4 : 0;
+  return flush + ((cards & cut_suit & jacks) != 0);
+}
+
+constexpr int score_hand(Hand hand, Card cut, bool is_crib) {
+  assert(hand.size() == 4);
+#ifdef CRIBBAGE_COUNTERS
+  // The table has no branches to count, so run the direct scorers alongside
+  if (!std::is_constant_evaluated()) {
+    is_crib ? COUNT(cribs, 1) : COUNT(hands, 1);
+    [[maybe_unused]] auto direct = score_hand_direct(hand, cut, is_crib);
+    assert(direct == rank_points[rank_multiset_index(hand, cut)] +
+                     score_suits(hand, cut, is_crib));
+  }
+#endif
+  return rank_points[rank_multiset_index(hand, cut)] + score_suits(hand, cut, is_crib);
+}
+
 constexpr int score_hand(std::string_view hand, std::string_view cut, bool is_crib) {
   return score_hand(make_hand(hand), make_card(cut), is_crib);
 }
@@ -520,6 +831,191 @@ static_assert(score_hand("5H 5C 5S JD", "5D", false) == 29);
 static_assert(score_hand("5H 5C 5S 5D", "JD", false) == 28);
 static_assert(score_hand("6C 4D 6D 4S", "5D", false) == 24);
 
+/* Score a hand of any size (up to four cards) plus the cut.  This is what
+   five-card cribbage needs for its three-card hold.  The scorers above are
+   unrolled for exactly four cards and remain the ones used for standard
+   hands; this one is generic over `N` so the compiler can still unroll it. */
+template <size_t N>
+constexpr int score_hand_generic(Hand hand, Card cut, bool is_crib) {
+  assert(hand.size() == N);
+  COUNT(generic, 1);
+  Card cards[N + 1];
+  for (size_t i = 0; i < N; ++i)
+    cards[i] = hand.take();
+  cards[N] = cut;
+
+  int score = 0;
+
+  // 15s - every subset of the N+1 cards
+  for (unsigned subset = 1; subset < (1u << (N + 1)); ++subset) {
+    int sum = 0;
+    for (size_t i = 0; i <= N; ++i)
+      if (subset & (1u << i))
+        sum += cards[i].value();
+    if (sum == 15)
+      score += 2;
+  }
+
+  // pairs
+  for (size_t i = 0; i <= N; ++i)
+    for (size_t j = i + 1; j <= N; ++j)
+      if (cards[i].rank() == cards[j].rank())
+        score += 2;
+
+  // runs - each maximal run of 3 or more ranks scores its length once
+  // for every way of picking one card of each rank
+  unsigned counts[num_ranks] = {};
+  for (auto card : cards)
+    ++counts[card.rank()];
+  for (Rank r = 0; r < num_ranks;) {
+    if (counts[r] == 0) {
+      ++r;
+      continue;
+    }
+    int length = 0;
+    int ways = 1;
+    for (; r < num_ranks && counts[r] != 0; ++r) {
+      ++length;
+      ways *= counts[r];
+    }
+    if (length >= 3)
+      score += length * ways;
+  }
+
+  // flush
+  bool flush = true;
+  for (size_t i = 1; i < N; ++i)
+    if (cards[i].suit() != cards[0].suit())
+      flush = false;
+  if (flush) {
+    if (cards[0].suit() == cut.suit())
+      score += N + 1;
+    else if (!is_crib) // the crib needs all five cards
+      score += N;
+  }
+
+  // nobs
+  constexpr Rank jack = 10;
+  for (size_t i = 0; i < N; ++i)
+    if (cards[i].rank() == jack && cards[i].suit() == cut.suit())
+      ++score;
+
+  return score;
+}
+
+constexpr int score_hand_generic(std::string_view hand, std::string_view cut, bool is_crib) {
+  auto h = make_hand(hand);
+  switch (h.size()) {
+  case 3:
+    return score_hand_generic<3>(h, make_card(cut), is_crib);
+  case 4:
+    return score_hand_generic<4>(h, make_card(cut), is_crib);
+  }
+  throw std::runtime_error("unsupported hand size");
+}
+
+// The generic scorer agrees with the unrolled one...
+static_assert(score_hand_generic("AH AS JD AC", "AD", false) == 13);
+static_assert(score_hand_generic("AH 3H 7H TH", "JS", false) == 4);
+static_assert(score_hand_generic("AH 3H 7H TH", "JS", true) == 0);
+static_assert(score_hand_generic("7H 7S 7C 8D", "8H", false) == 20);
+static_assert(score_hand_generic("3H AH 3S 2H", "3D", false) == 15);
+static_assert(score_hand_generic("5H 5C 5S JD", "5D", false) == 29);
+static_assert(score_hand_generic("6C 4D 6D 4S", "5D", false) == 24);
+static_assert(score_hand_generic("3C 4D 4C 5S", "5D", false) == 16);
+static_assert(score_hand_generic("AH 2H 3H 4H", "5H", false) == 5 + 2 + 5);
+// ...and handles three-card holds
+static_assert(score_hand_generic("5H 5C JD", "5D", false) == 8 + 6 + 1);
+static_assert(score_hand_generic("AH 2H 3H", "9S", false) == 2 + 3 + 3);
+static_assert(score_hand_generic("AH 2H 3H", "4H", false) == 4 + 4);
+static_assert(score_hand_generic("AH 2H 3H", "9S", true) == 2 + 3);
+static_assert(score_hand_generic("7H 8H 8S", "9D", false) == 4 + 2 + 6);
+
+// ---------------------------------------------------------------------------
+
+/* A rules policy describes a variant of the game as compile-time constants.
+   `analyze_hand` is instantiated once per policy, so every variant gets its
+   own fully inlined hot loop with no runtime branches on the rules. */
+template<typename T>
+concept RulesPolicy = requires {
+  { T::name } -> std::convertible_to<std::string_view>;
+  { T::num_players } -> std::convertible_to<size_t>;
+  { T::deal_size } -> std::convertible_to<size_t>;
+  { T::num_discards } -> std::convertible_to<size_t>;
+  { T::crib_from_deck } -> std::convertible_to<size_t>;
+  { T::crib_four_flush } -> std::convertible_to<bool>;
+};
+
+// Two players, six cards each, two to the crib
+struct StandardRules {
+  static constexpr std::string_view name = "standard";
+  static constexpr size_t num_players = 2;
+  static constexpr size_t deal_size = 6;
+  static constexpr size_t num_discards = 2;    // per player
+  static constexpr size_t crib_from_deck = 0;  // dealt straight to the crib
+  static constexpr bool crib_four_flush = false;
+};
+
+// Three players, five cards each, one each to the crib plus one from the deck
+struct ThreePlayerRules : StandardRules {
+  static constexpr std::string_view name = "three-player";
+  static constexpr size_t num_players = 3;
+  static constexpr size_t deal_size = 5;
+  static constexpr size_t num_discards = 1;
+  static constexpr size_t crib_from_deck = 1;
+};
+
+// Five-card cribbage: five cards each, two to the crib, hold three
+struct FiveCardRules : StandardRules {
+  static constexpr std::string_view name = "five-card";
+  static constexpr size_t deal_size = 5;
+};
+
+// House rule: a four-card flush in the crib counts, same as in the hand
+struct CribFourFlushRules : StandardRules {
+  static constexpr std::string_view name = "crib-four-flush";
+  static constexpr bool crib_four_flush = true;
+};
+
+template <RulesPolicy Rules>
+constexpr size_t hold_size = Rules::deal_size - Rules::num_discards;
+
+// Cards we haven't seen: everything but our own deal
+template <RulesPolicy Rules>
+constexpr size_t deck_size = all_cards.size() - Rules::deal_size;
+
+// Crib cards we don't know: the other players' discards and any from the deck
+template <RulesPolicy Rules>
+constexpr size_t crib_unknown =
+  (Rules::num_players - 1) * Rules::num_discards + Rules::crib_from_deck;
+
+template <RulesPolicy Rules>
+constexpr bool valid_rules =
+  Rules::num_players * Rules::num_discards + Rules::crib_from_deck == 4 &&
+  hold_size<Rules> >= 3 && hold_size<Rules> <= 4;
+
+static_assert(valid_rules<StandardRules>);
+static_assert(valid_rules<ThreePlayerRules>);
+static_assert(valid_rules<FiveCardRules>);
+static_assert(valid_rules<CribFourFlushRules>);
+
+template <RulesPolicy Rules>
+constexpr int score_hold(Hand hold, Card cut) {
+  if constexpr (hold_size<Rules> == 4)
+    return score_hand(hold, cut, false);
+  else
+    return score_hand_generic<hold_size<Rules>>(hold, cut, false);
+}
+
+template <RulesPolicy Rules>
+constexpr int score_crib(Hand crib, Card cut) {
+  return score_hand(crib, cut, !Rules::crib_four_flush);
+}
+
+static_assert(score_crib<StandardRules>(make_hand("AH 3H 7H TH"), make_card("JS")) == 0);
+static_assert(score_crib<CribFourFlushRules>(make_hand("AH 3H 7H TH"), make_card("JS")) == 4);
+static_assert(score_hold<FiveCardRules>(make_hand("5H 5C JD"), make_card("5D")) == 15);
+
 // ---------------------------------------------------------------------------
 
 /* A ChoiceHandler is a type like `void f(Hand choice)`.  That is, a
@@ -548,30 +1044,265 @@ void for_each_choice(Hand hand, size_t num_choose, T const &func) {
   for_each_choice_internal(hand, num_choose, Hand{}, func);
 }
 
-struct [[nodiscard]] Tally {
-  static constexpr const int max_score = 29 + 24; // 29 in hand, 24 in crib (44665)
-  static constexpr const int min_score = -29;     // 0 in hand, 29 in opp crib
+// `first` is the number of the first choice below `chosen`
+template <ChoiceHandler T>
+constexpr
+void for_each_choice_internal(Hand hand, size_t num_choose, Hand chosen, size_t first,
+                              size_t begin, size_t end, T const &func) {
+  if (chosen.size() == num_choose) {
+    func(chosen);
+    return;
+  }
+  while (first < end && hand.size()) {
+    auto card = hand.take();
+    size_t below = num_combinations(hand.size(), num_choose - chosen.size() - 1);
+    if (first + below > begin) {
+      chosen.insert(card);
+      for_each_choice_internal(hand, num_choose, chosen, first, begin, end, func);
+      chosen.remove(card);
+    }
+    first += below;
+  }
+}
+
+// Only choices [begin, end) of those `for_each_choice` makes, in the same
+// order, skipping straight to `begin`, so an enumeration can be split up
+template <ChoiceHandler T>
+constexpr
+void for_each_choice(Hand hand, size_t num_choose, size_t begin, size_t end, T const &func) {
+  for_each_choice_internal(hand, num_choose, Hand{}, 0, begin, end, func);
+}
+
+static_assert([] {
+  auto hand = make_hand("AS 2S 3S 4S 5S 6S 7S");
+  uint64_t whole[35], pieces[35];
+  size_t n = 0, m = 0;
+  for_each_choice(hand, 3, [&](Hand h) { whole[n++] = h.bits(); });
+  for (auto [begin, end] : {std::pair{0, 1}, {1, 17}, {17, 34}, {34, 35}})
+    for_each_choice(hand, 3, begin, end, [&](Hand h) { pieces[m++] = h.bits(); });
+  return n == 35 && m == 35 && std::equal(whole, whole + n, pieces);
+}());
+
+// Call `func(i)` for each `i` in [0, n), spread over `jobs` threads
+template <typename F>
+void parallel_for(size_t n, unsigned jobs, F const &func) {
+  std::atomic<size_t> next{0};
+  auto worker = [&] {
+    for (size_t i; (i = next++) < n;)
+      func(i);
+  };
+  std::vector<std::thread> threads;
+  for (unsigned j = 1; j < jobs && j < n; ++j)
+    threads.emplace_back(worker);
+  worker();
+  for (auto &thread : threads)
+    thread.join();
+}
+
+unsigned default_jobs() {
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// ---------------------------------------------------------------------------
+
+/* Relabeling the suits never changes a score, so many questions only need
+   answering once per suit pattern.  A SuitPermutation maps suit `s` to
+   `to[s]`. */
+struct SuitPermutation {
+  Suit to[num_suits];
+
+  constexpr Hand operator()(Hand hand) const noexcept {
+    uint64_t bits = 0;
+    for (Suit s = 0; s < num_suits; ++s)
+      bits |= ((hand.bits() >> (s * 16)) & 0x1fff) << (to[s] * 16);
+    return Hand{bits};
+  }
+};
+
+constexpr auto suit_permutations = [] {
+  std::array<SuitPermutation, 24> perms{};
+  SuitPermutation p{{0, 1, 2, 3}};
+  size_t i = 0;
+  do
+    perms[i++] = p;
+  while (std::next_permutation(std::begin(p.to), std::end(p.to)));
+  return perms;
+}();
+
+static_assert(suit_permutations[23](make_hand("AS 2D 3C 4H")).bits() ==
+              make_hand("AH 2C 3D 4S").bits());
+
+// The permutations that leave `fixed` unchanged
+std::vector<SuitPermutation> stabilizer(Hand fixed) {
+  std::vector<SuitPermutation> result;
+  for (auto &perm : suit_permutations)
+    if (perm(fixed).bits() == fixed.bits())
+      result.push_back(perm);
+  return result;
+}
+
+// The smallest image of `hand` under `perms`
+Hand canonical(Hand hand, std::vector<SuitPermutation> const &perms) {
+  auto best = hand;
+  for (auto &perm : perms)
+    if (auto h = perm(hand); h.bits() < best.bits())
+      best = h;
+  return best;
+}
+
+/* A histogram of scores, and so the exact distribution of the scores.
+   `Count` is `int` when every hand counts once, or a wider integer when
+   hands are weighted (or `double` for sampling weights).  Each statistic
+   below is computed from the histogram when asked for, in a pass or two
+   over its 83 bins, so counting a hand costs nothing extra, and tallies
+   from different threads merge by adding their bins.  The default range
+   covers a hand and either crib. */
+template <typename Count,
+          int Min = -29,       // 0 in hand, 29 in opp crib
+          int Max = 29 + 24>   // 29 in hand, 24 in crib (44665)
+struct [[nodiscard]] BasicTally {
+  static constexpr const int max_score = Max;
+  static constexpr const int min_score = Min;
   static constexpr const size_t size = max_score - min_score + 1;
-  int scores[size];
+  Count scores[size];
   void increment(int score)
+  {
+    add(score, 1);
+  }
+  void add(int score, Count weight)
   {
     int i = score - min_score;
     assert(i >= 0 && size_t(i) < size);
-    ++scores[i];
+    scores[i] += weight;
+  }
+  BasicTally &operator+=(BasicTally const &other)
+  {
+    for (size_t i = 0; i < size; ++i)
+      scores[i] += other.scores[i];
+    return *this;
+  }
+  Count count(int score) const
+  {
+    return scores[score - min_score];
+  }
+
+  // Exact integer moments: the total weight, and the weighted sums of the
+  // scores and of their squares
+  using Sum = std::conditional_t<std::is_floating_point_v<Count>, double, int64_t>;
+  struct Moments {
+    Sum n = 0;
+    Sum sum = 0;
+    Sum sum_squares = 0;
+  };
+  Moments moments() const
+  {
+    Moments m;
+    for (size_t i = 0; i < size; ++i) {
+      Sum score = int(i) + min_score;
+      m.n += scores[i];
+      m.sum += scores[i] * score;
+      m.sum_squares += scores[i] * score * score;
+    }
+    return m;
+  }
+  double mean() const
+  {
+    auto m = moments();
+    return double(m.sum) / m.n;
+  }
+  // The population variance of the scores.  With integer counts it's
+  // n * sum_squares - sum * sum, exactly, over n squared: rounded once, and
+  // never negative.  Fractional weights have no exact moments, so then it's
+  // the weighted squared deviations from the mean.
+  double variance() const
+  {
+    auto m = moments();
+    if constexpr (std::is_floating_point_v<Count>) {
+      double const mean = m.sum / m.n;
+      double sum = 0;
+      for (size_t i = 0; i < size; ++i) {
+        double const deviation = int(i) + min_score - mean;
+        sum += scores[i] * deviation * deviation;
+      }
+      return sum / m.n;
+    } else {
+      __extension__ using int128 = __int128;
+      auto const numerator = int128(m.n) * m.sum_squares - int128(m.sum) * m.sum;
+      assert(numerator >= 0);
+      return double(numerator) / (double(m.n) * double(m.n));
+    }
+  }
+  double stdev() const
+  {
+    return std::sqrt(variance());
+  }
+  // The smallest score with at least fraction `p` of the hands at or below it
+  int percentile(double p) const
+  {
+    auto n = moments().n;
+    Count cumulative = 0;
+    for (size_t i = 0; i < size; ++i) {
+      cumulative += scores[i];
+      if (scores[i] != 0 && cumulative >= p * n)
+        return int(i) + min_score;
+    }
+    return max_score;
+  }
+  // The probability of scoring `score` or more
+  double at_least(int score) const
+  {
+    Count above = 0;
+    for (int s = std::max(score, min_score); s <= max_score; ++s)
+      above += count(s);
+    return double(above) / moments().n;
+  }
+  // The mean less `lambda` standard deviations, for risk-averse choices
+  double risk_adjusted(double lambda) const
+  {
+    return mean() - lambda * stdev();
   }
-  Tally()
+  BasicTally()
   {
     std::fill(scores, scores + size, 0);
   }
-  Tally(std::initializer_list<int> s)
+  BasicTally(std::initializer_list<Count> s)
   {
-    int i = 0;
+    size_t i = 0;
     for (auto v : s)
         scores[i++] = v;
     assert(i == size);
   }
 };
 
+using Tally = BasicTally<int>;
+using WeightedTally = BasicTally<int64_t>;
+
+/* How many hands score each hold score and crib score together.  Counting
+   loops add each hand here once, and the tallies when the crib is mine and
+   when it's theirs, or any other weighing of the crib, are derived from
+   its 900 cells afterwards. */
+struct [[nodiscard]] JointTally {
+  static constexpr int max_score = 29; // in a hand or a crib
+  int counts[max_score + 1][max_score + 1] = {}; // [hold][crib]
+
+  void add(int hold, int crib, int n = 1) {
+    assert(hold >= 0 && hold <= max_score && crib >= 0 && crib <= max_score);
+    counts[hold][crib] += n;
+  }
+
+  // The tally of the hold plus `crib_sign` times the crib
+  Tally combined(int crib_sign) const {
+    Tally t;
+    for (int hold = 0; hold <= max_score; ++hold)
+      for (int crib = 0; crib <= max_score; ++crib)
+        if (auto n = counts[hold][crib])
+          t.add(hold + crib_sign * crib, n);
+    return t;
+  }
+  Tally mine() const { return combined(+1); }
+  Tally theirs() const { return combined(-1); }
+};
+
 struct [[nodiscard]] Statistics {
   double mean{};
   double stdev{};
@@ -579,33 +1310,54 @@ struct [[nodiscard]] Statistics {
   int max{};
 
   Statistics() = delete;
-  constexpr Statistics(Tally const &t, int num_hands);
+  constexpr Statistics(double mean, double stdev, int min, int max)
+  : mean{mean}, stdev{stdev}, min{min}, max{max}
+  {}
+  constexpr Statistics(Tally const &t, int num_hands)
+  : Statistics(t, num_hands, num_hands)
+  {}
+  // For sampled tallies `total` is the number of samples, and the spread is
+  // over as many hands as an exact analysis counts, to compare with it
+  template <typename Count, int Min, int Max>
+  constexpr Statistics(BasicTally<Count, Min, Max> const &t, Count total, int num_hands);
+
+  // The weighted mean and standard deviation, for a weighted tally, where the
+  // spread above (which counts each score once, whatever its weight) would
+  // mean nothing
+  template <typename Count, int Min, int Max>
+  static Statistics weighted(BasicTally<Count, Min, Max> const &t) {
+    return {t.mean(), t.stdev(), t.percentile(0), t.percentile(1)};
+  }
 };
 
+// The reference for Writer's output, which must match it byte for byte
+[[maybe_unused]]
 std::ostream &operator<<(std::ostream &os, Statistics const &st) {
   os << std::fixed << std::setprecision(1);
   return os << st.mean << ' ' << st.stdev << ' ' << st.min << ".." << st.max;
 }
 
-constexpr Statistics::Statistics(Tally const &t, int num_hands) {
+template <typename Count, int Min, int Max>
+constexpr Statistics::Statistics(BasicTally<Count, Min, Max> const &t, Count total,
+                                 int num_hands) {
   min = 0;
-  for (int i = 0; size_t(i) < Tally::size; ++i)
+  for (int i = 0; size_t(i) < t.size; ++i)
     if (t.scores[i] != 0) {
-      min = i + Tally::min_score;
+      min = i + t.min_score;
       break;
     }
 
   max = 0;
-  for (int i = Tally::size; --i >= 0;)
+  for (int i = t.size; --i >= 0;)
     if (t.scores[i] != 0) {
-      max = i + Tally::min_score;
+      max = i + t.min_score;
       break;
     }
 
   double sum = 0;
   for (int score = min; score <= max; ++score)
-    sum += double(score) * t.scores[score - Tally::min_score];
-  mean = sum / num_hands;
+    sum += double(score) * t.scores[score - t.min_score];
+  mean = sum / total;
 
   double sumdev = 0;
   for (int score = min; score <= max; ++score) {
@@ -615,75 +1367,3084 @@ constexpr Statistics::Statistics(Tally const &t, int num_hands) {
   stdev = sqrt(sumdev / num_hands);
 }
 
-void analyze_hand(Hand hand) {
-  /*
-    Find all possible pairs of cards to discard to the crib.
-    There are C(6,2)=15 possible discards in a cribbage hand.
-   */
-  cout << "[ " << hand << " ]\n";
-  assert(hand.size() == 6);
+// ---------------------------------------------------------------------------
 
-  for_each_choice(hand, 2, [&hand](Hand discard) {
-    Hand hold{hand};
-    hold.remove(discard);
+/* Formats analysis output without iostreams: no locale, no stream state, no
+   synchronized cout per piece.  Everything is appended to a buffer that's
+   reused from one hand to the next and written to stdout in large blocks.
+   Numbers are converted by hand, and fixed-point output is rounded exactly
+   as printf and iostreams round it, from the double's exact binary value
+   with ties to even.  The output matches the iostream form byte for byte
+   (that's checked in the unit tests). */
+class Writer {
+  std::string buffer_;
+  bool holding_ = false;
 
-    Hand deck{all_cards};
-    deck.remove(hand);
-    assert(deck.size() == 46);
+public:
+  static constexpr size_t block_size = 1 << 16;
 
-    Tally mine_tally;           // scores when the crib is mine
-    Tally theirs_tally;         // scores then the crib is theirs
-    int num_hands = 0;
-    for_each_choice(deck, 2, [&](Hand chosen) {
-      auto remaining_deck{deck};
-      remaining_deck.remove(chosen);
-      assert(remaining_deck.size() == 44);
+  Writer() = default;
+  explicit Writer(size_t capacity) {
+    buffer_.reserve(capacity);
+  }
+  Writer(Writer const &) = delete;
+  Writer &operator=(Writer const &) = delete;
 
-      auto card1 = chosen.take();
-      auto card2 = chosen.take();
+  std::string_view view() const { return buffer_; }
+  void clear() { buffer_.clear(); }
+  // Keep everything in the buffer for `view`, however big it gets
+  void hold() { holding_ = true; }
 
-      Hand crib{discard};
-      crib.insert(card1);
-      crib.insert(card2);
-      assert(crib.size() == 4);
+  void flush() {
+    std::fwrite(buffer_.data(), 1, buffer_.size(), stdout);
+    buffer_.clear();
+  }
+  // Write out whole blocks as they fill up
+  void flush_if_full() {
+    if (buffer_.size() >= block_size && !holding_)
+      flush();
+  }
 
-      while (auto cut = remaining_deck.take()) {
-        auto hold_score = score_hand(hold, cut, false);
-        auto crib_score = score_hand(crib, cut, true);
+  Writer &operator<<(char c) {
+    buffer_ += c;
+    return *this;
+  }
+  Writer &operator<<(std::string_view str) {
+    buffer_ += str;
+    return *this;
+  }
+  Writer &operator<<(uint64_t n) {
+    char digits[20];
+    char *p = std::end(digits);
+    do {
+      *--p = char('0' + n % 10);
+      n /= 10;
+    } while (n);
+    buffer_.append(p, std::end(digits));
+    return *this;
+  }
+  Writer &operator<<(int64_t n) {
+    if (n < 0)
+      buffer_ += '-';
+    return *this << (n < 0 ? 0 - uint64_t(n) : uint64_t(n));
+  }
+  Writer &operator<<(int n) {
+    return *this << int64_t(n);
+  }
+  Writer &operator<<(Card card) {
+    return *this << rank_chars[card.rank()] << suit_chars[card.suit()];
+  }
+  Writer &operator<<(Hand hand) {
+    bool sep = false;
+    while (auto card = hand.take()) {
+      if (sep)
+        *this << ' ';
+      *this << card;
+      sep = true;
+    }
+    return *this;
+  }
+  Writer &operator<<(Statistics const &st) {
+    fixed(st.mean, 1) << ' ';
+    fixed(st.stdev, 1) << ' ';
+    return *this << st.min << ".." << st.max;
+  }
 
-        auto mine_score = hold_score + crib_score;
-        auto theirs_score = hold_score - crib_score;
+  // `x` with `digits` decimal places, like std::fixed
+  Writer &fixed(double x, int digits) {
+    assert(digits >= 0 && digits <= 4);
+    constexpr uint64_t powers_of_10[] = {1, 10, 100, 1000, 10000};
+    if (!(std::abs(x) < 0x1p52)) { // too big for the exact method, or NaN
+      char text[400];
+      auto [end, ec] = std::to_chars(text, std::end(text), x, std::chars_format::fixed, digits);
+      assert(ec == std::errc{});
+      return *this << std::string_view(text, end - text);
+    }
+    // x = mantissa / 2^shift exactly, so x * 10^digits is a fraction of
+    // integers and can be rounded without error
+    int exponent;
+    auto mantissa = uint64_t(std::ldexp(std::abs(std::frexp(x, &exponent)), 53));
+    int shift = 53 - exponent;
+    assert(shift > 0);
+    __extension__ using uint128 = unsigned __int128;
+    auto scaled = uint128(mantissa) * powers_of_10[digits];
+    uint64_t rounded = 0;
+    if (shift < 128) {
+      auto quotient = uint64_t(scaled >> shift);
+      auto remainder = scaled & ((uint128(1) << shift) - 1);
+      auto half = uint128(1) << (shift - 1);
+      rounded = quotient + (remainder > half || (remainder == half && (quotient & 1)));
+    }
+    if (std::signbit(x))
+      *this << '-';
+    *this << rounded / powers_of_10[digits];
+    if (digits > 0) {
+      char fraction[4];
+      auto f = rounded % powers_of_10[digits];
+      for (int i = digits; i-- > 0; f /= 10)
+        fraction[i] = char('0' + f % 10);
+      *this << '.' << std::string_view(fraction, digits);
+    }
+    return *this;
+  }
+};
 
-        ++num_hands;
+// This thread's buffer for stdout
+Writer &output() {
+  thread_local Writer out(2 * Writer::block_size);
+  return out;
+}
 
-        mine_tally.increment(mine_score);
-        theirs_tally.increment(theirs_score);
-      }
-    });
-    // deck size: 46, C(46,2)=1035
-    // remaining_deck size: 44
-    assert(num_hands == 1035 * 44);
+// The histogram as `score:count` for each score that occurs
+template <typename Count>
+Writer &operator<<(Writer &out, BasicTally<Count> const &t) {
+  bool sep = false;
+  for (size_t i = 0; i < BasicTally<Count>::size; ++i) {
+    if (t.scores[i] == 0)
+      continue;
+    if (sep)
+      out << ' ';
+    out << int(i) + BasicTally<Count>::min_score << ':' << int64_t(t.scores[i]);
+    sep = true;
+  }
+  return out;
+}
 
-    /* Calculate statistics (mean, standard deviation, min and max)
-       for both situations when it's my crib and when it's theirs. */
-    Statistics if_mine(mine_tally, num_hands);
-    Statistics if_theirs(theirs_tally, num_hands);
+// ---------------------------------------------------------------------------
 
-    cout << discard << " [" << if_mine << ']' << " [" << if_theirs << "]\n";
-  });
-  cout << '\n';
-}
+class ResultCache;
+class StatsTable;
+class StatsTableView;
 
-void analyze_hand(std::string_view str) {
-  auto hand = make_hand(str);
-  if (hand.size() != 6)
-    throw std::runtime_error("Expected six cards '" + std::string(str) + '\'');
-  analyze_hand(hand);
+// Settings from the command line
+struct Options {
+  ResultCache *cache = nullptr; // --cache=DIR
+  StatsTable *table = nullptr;  // --table=PATH
+  StatsTableView const *use_table = nullptr; // --use-table=PATH
+  bool verbose = false;
+  unsigned jobs = default_jobs();
+  Hand dead;                   // --dead=CARDS: known to be out of the deck
+  bool binary = false;         // binary rather than text tables
+  bool distribution = false;   // report percentiles etc. for each discard
+  bool batch = false;          // analyze consecutive deals together
+  bool pipeline = false;       // --file: parse, analyze and write concurrently
+  int samples = 0;             // draws per discard or opponent deals, 0 for the default
+  double deadline_ms = 0;      // --serve: for requests without one, 0 for none
+  int at_least = 20;           // ...including the chance of this many points
+  double risk = 1.0;           // ...and the mean less this many stdevs
+  unsigned shard = 0;          // --shard=I/N: which part of an enumeration
+  unsigned num_shards = 1;
+  std::string checkpoint;      // ...and where to keep its progress
+};
+
+// One line summarizing the exact distribution of a tally
+template <typename Count, int Min, int Max>
+void print_distribution(Writer &out, std::string_view label,
+                        BasicTally<Count, Min, Max> const &t, Options const &options) {
+  out << "  " << label;
+  for (auto width = label.size(); width < 6; ++width)
+    out << ' ';
+  out << " sd=";
+  out.fixed(t.stdev(), 2);
+  for (int p : {10, 25, 50, 75, 90})
+    out << " p" << p << '=' << t.percentile(p / 100.0);
+  out << " P(>=" << options.at_least << ")=";
+  out.fixed(t.at_least(options.at_least), 3) << " mean-";
+  out.fixed(options.risk, 2) << "sd=";
+  out.fixed(t.risk_adjusted(options.risk), 2) << '\n';
+}
+
+// ---------------------------------------------------------------------------
+
+// What analyze_hand reports for one discard
+struct DiscardResult {
+  Hand discard;
+  Statistics if_mine;
+  Statistics if_theirs;
+};
+
+uint64_t fnv1a(void const *data, size_t size,
+                         uint64_t hash = 0xcbf29ce484222325) {
+  auto bytes = static_cast<unsigned char const *>(data);
+  for (size_t i = 0; i < size; ++i)
+    hash = (hash ^ bytes[i]) * 0x100000001b3;
+  return hash;
+}
+
+constexpr uint64_t fnv1a(std::string_view str, uint64_t hash = 0xcbf29ce484222325) {
+  for (unsigned char c : str)
+    hash = (hash ^ c) * 0x100000001b3;
+  return hash;
+}
+
+constexpr SuitPermutation inverse(SuitPermutation perm) {
+  SuitPermutation inv{};
+  for (Suit s = 0; s < num_suits; ++s)
+    inv.to[perm.to[s]] = s;
+  return inv;
+}
+
+/* A persistent cache of analyze_hand results, shared by every run that
+   uses the same --cache=DIR.
+
+   Results are keyed by the hand with its suits relabeled into canonical
+   form, so hands that differ only by suit share an entry, and by a hash of
+   the rules, analysis mode and any dead cards (relabeled the same way).
+   Records are appended to DIR/results and never rewritten.  Each carries a
+   checksum, so a record torn by a crash is recognized (and dropped) the
+   next time the cache is opened.
+
+   DIR/index is an open-addressing hash table from key to record offset,
+   mapped into memory.  It is only a hint: the record it leads to is checked
+   against its key and checksum before use, and the index is rebuilt from
+   DIR/results whenever it is missing, damaged or behind.  Processes sharing
+   the cache serialize with flock on the index. */
+class ResultCache {
+  static constexpr uint32_t record_magic = 0x43524942; // "CRIB"
+  static constexpr uint64_t index_magic = 0x31584449'42495243; // "CRIBIDX1"
+
+  struct Record {
+    uint32_t magic;
+    uint32_t num_discards;
+    uint64_t hand;     // canonical
+    uint64_t mode;
+    uint64_t checksum; // of the entries, seeded with the fields above
+  };
+  struct Entry {
+    uint64_t discard;  // canonical
+    double mean[2];    // mine, theirs
+    double stdev[2];
+    int32_t min[2];
+    int32_t max[2];
+  };
+  static constexpr uint32_t max_discards = 15;
+
+  struct IndexHeader {
+    uint64_t magic;
+    uint64_t capacity; // number of slots, a power of 2
+    uint64_t count;    // slots in use
+    uint64_t covered;  // bytes of DIR/results in the index
+  };
+  struct Slot {
+    uint64_t hand;     // 0 if the slot is empty
+    uint64_t mode;
+    uint64_t offset;
+  };
+
+  int results_fd_ = -1;
+  int index_fd_ = -1;
+  IndexHeader *header_ = nullptr;
+  size_t mapped_ = 0;
+  std::mutex mutex_; // flock doesn't exclude other threads
+
+public:
+  unsigned hits = 0;
+  unsigned misses = 0;
+
+  explicit ResultCache(std::string const &dir) {
+    if (::mkdir(dir.c_str(), 0777) != 0 && errno != EEXIST)
+      fail("Can't create", dir);
+    results_fd_ = ::open((dir + "/results").c_str(), O_RDWR | O_CREAT | O_APPEND, 0666);
+    if (results_fd_ < 0)
+      fail("Can't open", dir + "/results");
+    index_fd_ = ::open((dir + "/index").c_str(), O_RDWR | O_CREAT, 0666);
+    if (index_fd_ < 0)
+      fail("Can't open", dir + "/index");
+    Lock lock(index_fd_, LOCK_EX);
+    catch_up();
+  }
+
+  ~ResultCache() {
+    if (header_)
+      ::munmap(header_, mapped_);
+    ::close(index_fd_);
+    ::close(results_fd_);
+  }
+
+  ResultCache(ResultCache const &) = delete;
+  ResultCache &operator=(ResultCache const &) = delete;
+
+  // The results for `hand` (in no particular order), if they're cached
+  std::optional<std::vector<DiscardResult>> lookup(Hand hand, Hand dead, uint64_t mode) {
+    auto const [key, perm] = canonical_key(hand, dead, mode);
+    std::lock_guard guard(mutex_);
+    Lock lock(index_fd_, LOCK_EX);
+    catch_up();
+    for (auto *slot = probe(key, mode); slot->hand != 0; slot = next(slot)) {
+      if (slot->hand != key || slot->mode != mode)
+        continue;
+      Record record;
+      Entry entries[max_discards];
+      if (!read_record(slot->offset, record, entries) ||
+          record.hand != key || record.mode != mode)
+        break;
+      auto const back = inverse(perm);
+      std::vector<DiscardResult> results;
+      for (uint32_t i = 0; i < record.num_discards; ++i) {
+        auto &e = entries[i];
+        results.push_back({back(Hand{e.discard}),
+                           {e.mean[0], e.stdev[0], e.min[0], e.max[0]},
+                           {e.mean[1], e.stdev[1], e.min[1], e.max[1]}});
+      }
+      ++hits;
+      return results;
+    }
+    ++misses;
+    return std::nullopt;
+  }
+
+  void store(Hand hand, Hand dead, uint64_t mode, std::vector<DiscardResult> const &results) {
+    assert(results.size() <= max_discards);
+    auto const [key, perm] = canonical_key(hand, dead, mode);
+
+    struct {
+      Record record;
+      Entry entries[max_discards];
+    } buf{};
+    buf.record = {record_magic, uint32_t(results.size()), key, mode, 0};
+    for (size_t i = 0; i < results.size(); ++i) {
+      auto &r = results[i];
+      buf.entries[i] = {perm(r.discard).bits(),
+                        {r.if_mine.mean, r.if_theirs.mean},
+                        {r.if_mine.stdev, r.if_theirs.stdev},
+                        {r.if_mine.min, r.if_theirs.min},
+                        {r.if_mine.max, r.if_theirs.max}};
+    }
+    buf.record.checksum = checksum(buf.record, buf.entries);
+    auto const size = sizeof(Record) + results.size() * sizeof(Entry);
+
+    std::lock_guard guard(mutex_);
+    Lock lock(index_fd_, LOCK_EX);
+    catch_up();
+    auto offset = ::lseek(results_fd_, 0, SEEK_END);
+    if (::write(results_fd_, &buf, size) != ssize_t(size))
+      fail("Can't write", "cache results");
+    header_->covered = offset + size;
+    insert(key, mode, offset);
+  }
+
+private:
+  [[noreturn]] static void fail(std::string_view what, std::string const &name) {
+    throw std::runtime_error(std::string(what) + " '" + name + "': " + std::strerror(errno));
+  }
+
+  struct Lock {
+    int fd;
+    Lock(int fd, int how) : fd{fd} { ::flock(fd, how); }
+    ~Lock() { ::flock(fd, LOCK_UN); }
+  };
+
+  // Also folds the dead cards into `mode`, leaving it alone if there are none
+  static std::pair<uint64_t, SuitPermutation> canonical_key(Hand hand, Hand dead,
+                                                            uint64_t &mode) {
+    auto best = suit_permutations[0];
+    for (auto &perm : suit_permutations)
+      if (std::pair(perm(hand).bits(), perm(dead).bits()) <
+          std::pair(best(hand).bits(), best(dead).bits()))
+        best = perm;
+    if (dead.size()) {
+      auto const bits = best(dead).bits();
+      mode = fnv1a(&bits, sizeof bits, mode);
+    }
+    return {best(hand).bits(), best};
+  }
+
+  static uint64_t checksum(Record const &record, Entry const *entries) {
+    auto hash = fnv1a(&record, offsetof(Record, checksum));
+    return fnv1a(entries, record.num_discards * sizeof(Entry), hash);
+  }
+
+  bool read_record(uint64_t offset, Record &record, Entry *entries) const {
+    if (::pread(results_fd_, &record, sizeof record, offset) != sizeof record ||
+        record.magic != record_magic || record.num_discards > max_discards)
+      return false;
+    auto size = record.num_discards * sizeof(Entry);
+    if (::pread(results_fd_, entries, size, offset + sizeof record) != ssize_t(size))
+      return false;
+    return record.checksum == checksum(record, entries);
+  }
+
+  Slot *slots() const {
+    return reinterpret_cast<Slot *>(header_ + 1);
+  }
+
+  Slot *probe(uint64_t hand, uint64_t mode) const {
+    auto h = (hand ^ mode) * 0x9e3779b97f4a7c15;
+    return &slots()[(h >> 32) & (header_->capacity - 1)];
+  }
+
+  Slot *next(Slot *slot) const {
+    return ++slot == slots() + header_->capacity ? slots() : slot;
+  }
+
+  // (Re)map the index, creating an empty one if it isn't valid
+  void map_index(uint64_t capacity) {
+    if (header_)
+      ::munmap(header_, mapped_);
+    header_ = nullptr;
+    struct stat st;
+    if (::fstat(index_fd_, &st) != 0)
+      fail("Can't stat", "cache index");
+    bool valid = false;
+    if (size_t(st.st_size) >= sizeof(IndexHeader)) {
+      IndexHeader h;
+      valid = ::pread(index_fd_, &h, sizeof h, 0) == sizeof h &&
+              h.magic == index_magic && std::has_single_bit(h.capacity) &&
+              h.capacity >= capacity &&
+              size_t(st.st_size) == sizeof h + h.capacity * sizeof(Slot);
+      if (valid)
+        capacity = h.capacity;
+    }
+    mapped_ = sizeof(IndexHeader) + capacity * sizeof(Slot);
+    if (!valid && ::ftruncate(index_fd_, 0) != 0)
+      fail("Can't truncate", "cache index");
+    if (!valid && ::ftruncate(index_fd_, mapped_) != 0)
+      fail("Can't grow", "cache index");
+    void *p = ::mmap(nullptr, mapped_, PROT_READ | PROT_WRITE, MAP_SHARED, index_fd_, 0);
+    if (p == MAP_FAILED)
+      fail("Can't map", "cache index");
+    header_ = static_cast<IndexHeader *>(p);
+    if (!valid)
+      *header_ = {index_magic, capacity, 0, 0};
+  }
+
+  // Index any records appended since we last looked, by us or anyone else
+  void catch_up() {
+    if (!header_ || header_->magic != index_magic ||
+        mapped_ != sizeof(IndexHeader) + header_->capacity * sizeof(Slot))
+      map_index(1024);
+    auto const end = ::lseek(results_fd_, 0, SEEK_END);
+    if (uint64_t(end) < header_->covered)
+      map_index(header_->capacity * 2); // results shrank: start over
+    while (header_->covered < uint64_t(end)) {
+      Record record;
+      Entry entries[max_discards];
+      if (!read_record(header_->covered, record, entries)) {
+        // A torn record from a crash: drop it and anything after it
+        if (::ftruncate(results_fd_, header_->covered) != 0)
+          fail("Can't truncate", "cache results");
+        break;
+      }
+      auto offset = header_->covered;
+      header_->covered += sizeof record + record.num_discards * sizeof(Entry);
+      insert(record.hand, record.mode, offset);
+    }
+  }
+
+  void insert(uint64_t hand, uint64_t mode, uint64_t offset) {
+    if ((header_->count + 1) * 10 > header_->capacity * 7) {
+      // Too full: rebuild the index twice the size
+      auto capacity = header_->capacity * 2;
+      ::munmap(header_, mapped_);
+      header_ = nullptr;
+      if (::ftruncate(index_fd_, 0) != 0)
+        fail("Can't truncate", "cache index");
+      map_index(capacity);
+      catch_up();
+    }
+    auto *slot = probe(hand, mode);
+    while (slot->hand != 0 && (slot->hand != hand || slot->mode != mode))
+      slot = next(slot);
+    if (slot->hand == 0)
+      ++header_->count;
+    slot->offset = offset;
+    slot->mode = mode;
+    slot->hand = hand;
+  }
+};
+
+/* A compact table of analyze_hand results for many deals, written by
+   `--table=PATH`, printed by `--print-table=PATH` and consulted by
+   `--use-table=PATH`: 12 bytes per discard rather than the cache's 56.
+   Means and stdevs are kept in hundredths as 16-bit integers, and the mins
+   and maxes as bytes, each in a column of its own, so a scan over one
+   statistic reads only that.  A hundredth is picked so that rounding it to
+   one decimal prints just what the analysis did, nudging it off the
+   midpoint between tenths if need be, so the printed table is the same as
+   the analysis output.
+
+   The file is a Header, the deals (uint64_t) in the order they were given,
+   the index, and then the columns in the order of `for_each_column`, each
+   of num_deals * discards_per_deal entries in for_each_choice order, all
+   padded to 8 bytes.  The index has a key and row for each deal, sorted by
+   key: the deal with its suits relabeled into canonical form (leaving the
+   dead cards alone), so a deal, or any deal that differs from it only by
+   suit, is found by a binary search.  The header has a checksum of itself
+   and of everything after it.
+
+   A StatsTable is built in memory and written whole, and a StatsTableView
+   reads one in place, memory-mapped, so processes using the same table
+   share it through the page cache. */
+
+// Apply `func(column)` to each column of a table in file order
+template <typename T, typename F>
+void for_each_column(T &table, F const &func);
+
+struct StatsTableFormat {
+  static constexpr std::string_view magic = "CRIBQTB2";
+
+  struct Header {
+    char magic[8];
+    uint64_t mode;     // the rules, analysis mode and dead cards
+    uint64_t dead;
+    uint32_t deal_size;
+    uint32_t num_discards;
+    uint64_t num_deals;
+    uint64_t data_checksum;
+    uint64_t header_checksum; // of the fields above
+  };
+  struct IndexEntry {
+    uint64_t key;      // canonical
+    uint64_t row;      // in the deals
+  };
+
+  // The permutation of `perms` that takes `deal` to its canonical form
+  static SuitPermutation canonicalizing(Hand deal, std::vector<SuitPermutation> const &perms) {
+    auto best = perms.front();
+    for (auto &perm : perms)
+      if (perm(deal).bits() < best(deal).bits())
+        best = perm;
+    return best;
+  }
+};
+
+class StatsTable : StatsTableFormat {
+  std::mutex mutex_;
+  uint64_t mode_ = 0;
+  Hand dead_;
+  uint32_t deal_size_ = 0;
+  uint32_t num_discards_ = 0;
+  std::vector<uint64_t> deals_;
+  // Mine, then theirs
+  std::vector<int16_t> mean_[2];
+  std::vector<uint16_t> stdev_[2];
+  std::vector<int8_t> min_[2];
+  std::vector<int8_t> max_[2];
+
+  template <typename T, typename F>
+  friend void for_each_column(T &table, F const &func);
+
+  static std::string tenths(double x) {
+    Writer out;
+    out.fixed(x, 1);
+    return std::string(out.view());
+  }
+
+  // The first deal decides what the rest must match; called with the lock held
+  void check(uint64_t mode, Hand dead, size_t deal_size, size_t num_discards) {
+    if (deals_.empty()) {
+      mode_ = mode;
+      dead_ = dead;
+      deal_size_ = uint32_t(deal_size);
+      num_discards_ = uint32_t(num_discards);
+    } else if (mode != mode_ || dead.bits() != dead_.bits() || deal_size != deal_size_ ||
+               num_discards != num_discards_)
+      throw std::runtime_error("A table can't mix rules, modes or dead cards");
+  }
+
+public:
+  // `x` in hundredths, the nearest that prints with one decimal as `x` does
+  template <typename Int>
+  static Int quantize(double x) {
+    auto const nearest = std::llround(x * 100);
+    auto const printed = tenths(x);
+    for (auto h : {nearest, nearest - 1, nearest + 1})
+      if (tenths(double(h) / 100) == printed) {
+        if (h < std::numeric_limits<Int>::min() || h > std::numeric_limits<Int>::max())
+          break;
+        return Int(h);
+      }
+    throw std::runtime_error("Can't fit " + printed + " in a table");
+  }
+
+  size_t size() const { return deals_.size(); }
+
+  // Add a deal's results, which can be in any order, after the deals before it
+  void add(Hand deal, size_t num_discards, uint64_t mode, Hand dead,
+           std::vector<DiscardResult> const &results) {
+    std::lock_guard lock(mutex_);
+    check(mode, dead, deal.size(), num_discards);
+    deals_.push_back(deal.bits());
+    for_each_choice(deal, num_discards, [&](Hand discard) {
+      auto r = std::find_if(results.begin(), results.end(), [&](auto &r) {
+        return r.discard.bits() == discard.bits();
+      });
+      assert(r != results.end());
+      size_t side = 0;
+      for (auto const *st : {&r->if_mine, &r->if_theirs}) {
+        if (st->min < INT8_MIN || st->max > INT8_MAX)
+          throw std::runtime_error("Can't fit a score range in a table");
+        mean_[side].push_back(quantize<int16_t>(st->mean));
+        stdev_[side].push_back(quantize<uint16_t>(st->stdev));
+        min_[side].push_back(int8_t(st->min));
+        max_[side].push_back(int8_t(st->max));
+        ++side;
+      }
+    });
+  }
+
+  // Add the deals of `staged` after these.  Deals analyzed concurrently are
+  // each added to a table of their own, and appended in the order given.
+  void append(StatsTable const &staged) {
+    if (staged.deals_.empty())
+      return;
+    std::lock_guard lock(mutex_);
+    check(staged.mode_, staged.dead_, staged.deal_size_, staged.num_discards_);
+    deals_.insert(deals_.end(), staged.deals_.begin(), staged.deals_.end());
+    auto append_sides = [](auto &to, auto const &from) {
+      for (size_t side = 0; side < 2; ++side)
+        to[side].insert(to[side].end(), from[side].begin(), from[side].end());
+    };
+    append_sides(mean_, staged.mean_);
+    append_sides(stdev_, staged.stdev_);
+    append_sides(min_, staged.min_);
+    append_sides(max_, staged.max_);
+  }
+
+  std::string serialize() const {
+    std::string data;
+    auto append = [&](auto const &column) {
+      data.append(reinterpret_cast<char const *>(column.data()),
+                  column.size() * sizeof column[0]);
+      data.resize((data.size() + 7) & ~size_t(7));
+    };
+    append(deals_);
+    auto const perms = stabilizer(dead_);
+    std::vector<IndexEntry> index;
+    for (size_t row = 0; row < deals_.size(); ++row) {
+      Hand const deal{deals_[row]};
+      index.push_back({canonicalizing(deal, perms)(deal).bits(), row});
+    }
+    std::sort(index.begin(), index.end(), [](auto const &a, auto const &b) {
+      return std::pair(a.key, a.row) < std::pair(b.key, b.row);
+    });
+    append(index);
+    for_each_column(*this, append);
+
+    Header header{};
+    std::copy(magic.begin(), magic.end(), header.magic);
+    header.mode = mode_;
+    header.dead = dead_.bits();
+    header.deal_size = deal_size_;
+    header.num_discards = num_discards_;
+    header.num_deals = deals_.size();
+    header.data_checksum = fnv1a(data.data(), data.size());
+    header.header_checksum = fnv1a(&header, offsetof(Header, header_checksum));
+    return std::string(reinterpret_cast<char const *>(&header), sizeof header) + data;
+  }
+
+  void write(std::string const &path) const {
+    auto temp = path + ".tmp";
+    {
+      std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+      auto const data = serialize();
+      out.write(data.data(), std::streamsize(data.size()));
+      if (!out.flush())
+        throw std::runtime_error("Can't write '" + temp + '\'');
+    }
+    if (std::rename(temp.c_str(), path.c_str()) != 0)
+      throw std::runtime_error("Can't rename '" + temp + "' to '" + path + '\'');
+  }
+};
+
+class StatsTableView : StatsTableFormat {
+  void *mapping_ = nullptr;
+  size_t mapped_ = 0;
+  Header header_{};
+  std::vector<SuitPermutation> perms_; // that leave the dead cards alone
+  size_t discards_per_deal_ = 0;
+  std::span<uint64_t const> deals_;
+  std::span<IndexEntry const> index_;
+  // Mine, then theirs
+  std::span<int16_t const> mean_[2];
+  std::span<uint16_t const> stdev_[2];
+  std::span<int8_t const> min_[2];
+  std::span<int8_t const> max_[2];
+
+  template <typename T, typename F>
+  friend void for_each_column(T &table, F const &func);
+
+  Statistics statistics(size_t side, size_t row) const {
+    return {mean_[side][row] / 100.0, stdev_[side][row] / 100.0, min_[side][row],
+            max_[side][row]};
+  }
+
+public:
+  StatsTableView() = default;
+  StatsTableView(StatsTableView const &) = delete;
+  StatsTableView &operator=(StatsTableView const &) = delete;
+  ~StatsTableView() {
+    if (mapping_)
+      ::munmap(mapping_, mapped_);
+  }
+
+  uint64_t mode() const { return header_.mode; }
+  size_t size() const { return deals_.size(); }
+
+  // View the table in `bytes`, which must outlive this and be 8-byte aligned
+  void parse(std::string_view bytes, std::string const &name) {
+    auto bad = [&](char const *why) {
+      return std::runtime_error("Bad table '" + name + "': " + why);
+    };
+    Header header;
+    if (bytes.size() < sizeof header)
+      throw bad("too short");
+    if (reinterpret_cast<uintptr_t>(bytes.data()) % alignof(uint64_t))
+      throw bad("misaligned");
+    std::memcpy(&header, bytes.data(), sizeof header);
+    if (std::string_view(header.magic, sizeof header.magic) != magic)
+      throw bad("not a table");
+    if (header.header_checksum != fnv1a(&header, offsetof(Header, header_checksum)))
+      throw bad("header checksum");
+    bytes.remove_prefix(sizeof header);
+    if (header.data_checksum != fnv1a(bytes.data(), bytes.size()))
+      throw bad("checksum");
+
+    if (header.deal_size > all_cards.size() || header.num_discards > header.deal_size ||
+        (header.dead & ~all_cards.bits()))
+      throw bad("deal size");
+    header_ = header;
+    perms_ = stabilizer(Hand{header.dead});
+    discards_per_deal_ = num_combinations(header.deal_size, header.num_discards);
+    auto const rows = header.num_deals * discards_per_deal_;
+    auto take = [&](auto &column, uint64_t n) {
+      using T = typename std::remove_reference_t<decltype(column)>::element_type;
+      if (n > bytes.size() / sizeof(T))
+        throw bad("truncated");
+      column = {reinterpret_cast<T const *>(bytes.data()), size_t(n)};
+      bytes.remove_prefix(std::min(bytes.size(), (n * sizeof(T) + 7) & ~uint64_t(7)));
+    };
+    take(deals_, header.num_deals);
+    take(index_, header.num_deals);
+    for_each_column(*this, [&](auto &column) { take(column, rows); });
+    if (!bytes.empty())
+      throw bad("trailing data");
+    for (auto deal : deals_)
+      if (Hand{deal}.size() != header.deal_size || (deal & ~all_cards.bits()))
+        throw bad("not a deal");
+    for (size_t i = 0; i < index_.size(); ++i)
+      if (index_[i].row >= deals_.size() || (i && index_[i].key < index_[i - 1].key))
+        throw bad("index");
+  }
+
+  // Map the table at `path` and view it
+  void map(std::string const &path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      throw std::runtime_error("Can't open '" + path + '\'');
+    struct stat st;
+    void *p = MAP_FAILED;
+    if (::fstat(fd, &st) == 0 && st.st_size > 0)
+      p = ::mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED)
+      throw std::runtime_error("Can't map '" + path + '\'');
+    mapping_ = p;
+    mapped_ = size_t(st.st_size);
+    parse({static_cast<char const *>(p), mapped_}, path);
+  }
+
+  // The results for `deal` (in no particular order), if the table was made
+  // with `mode` and has the deal or one that differs from it only by suit
+  std::optional<std::vector<DiscardResult>> lookup(Hand deal, uint64_t mode) const {
+    if (mode != header_.mode || deal.size() != header_.deal_size)
+      return std::nullopt;
+    auto const to_key = canonicalizing(deal, perms_);
+    auto const key = to_key(deal).bits();
+    auto const entry = std::lower_bound(index_.begin(), index_.end(), key,
+                                        [](IndexEntry const &e, uint64_t k) {
+      return e.key < k;
+    });
+    if (entry == index_.end() || entry->key != key)
+      return std::nullopt;
+    Hand const stored{deals_[entry->row]};
+    auto const from_stored = canonicalizing(stored, perms_);
+    auto const back = inverse(to_key);
+    std::vector<DiscardResult> results;
+    auto row = entry->row * discards_per_deal_;
+    for_each_choice(stored, header_.num_discards, [&](Hand discard) {
+      results.push_back({back(from_stored(discard)), statistics(0, row), statistics(1, row)});
+      ++row;
+    });
+    return results;
+  }
+
+  // The same as analyze_hand prints for each deal
+  void print(Writer &out) const {
+    size_t row = 0;
+    for (auto deal : deals_) {
+      out << "[ " << Hand{deal} << " ]\n";
+      for_each_choice(Hand{deal}, header_.num_discards, [&](Hand discard) {
+        out << discard;
+        for (size_t side = 0; side < 2; ++side)
+          out << " [" << statistics(side, row) << ']';
+        out << '\n';
+        ++row;
+      });
+      out << '\n';
+      out.flush_if_full();
+    }
+  }
+};
+
+template <typename T, typename F>
+void for_each_column(T &table, F const &func) {
+  for (auto &column : table.mean_) func(column);
+  for (auto &column : table.stdev_) func(column);
+  for (auto &column : table.min_) func(column);
+  for (auto &column : table.max_) func(column);
+}
+
+// ---------------------------------------------------------------------------
+
+/* Crib discard tables: for every 2-card discard, the exact distribution of
+   crib scores over all opponent discards and cuts.  With `held` empty this
+   is the unconditioned table (C(50,2)*48 cribs per discard); otherwise the
+   deck excludes the four cards we hold.  Discards related by a suit
+   permutation that leaves `held` alone have identical rows, so only one of
+   each is computed. */
+struct CribTableRow {
+  Hand discard;
+  Tally tally;
+  int num_hands = 0; // 0 if the discard overlaps `held`
+};
+
+template <RulesPolicy Rules = StandardRules>
+std::vector<CribTableRow> crib_table(Hand held, unsigned jobs) {
+  assert(held.size() == 0 || held.size() == 4);
+
+  std::vector<CribTableRow> rows;
+  for_each_choice(all_cards, 2, [&](Hand discard) {
+    rows.push_back({discard, {}, 0});
+  });
+  assert(rows.size() == num_combinations(52, 2));
+
+  // One representative discard per class of equivalent discards
+  auto const perms = stabilizer(held);
+  std::map<uint64_t, size_t> class_of;
+  std::vector<Hand> representatives;
+  std::vector<size_t> row_class(rows.size());
+  for (size_t i = 0; i < rows.size(); ++i) {
+    if (rows[i].discard.overlaps(held))
+      continue;
+    auto key = canonical(rows[i].discard, perms).bits();
+    auto [it, inserted] = class_of.try_emplace(key, representatives.size());
+    if (inserted)
+      representatives.push_back(rows[i].discard);
+    row_class[i] = it->second;
+  }
+
+  std::vector<CribTableRow> classes(representatives.size());
+  parallel_for(classes.size(), jobs, [&](size_t c) {
+    auto discard = representatives[c];
+    Hand deck{all_cards};
+    deck.remove(held);
+    deck.remove(discard);
+    auto &row = classes[c];
+    for_each_choice(deck, 2, [&](Hand theirs) {
+      auto remaining_deck{deck};
+      remaining_deck.remove(theirs);
+      Hand crib{discard};
+      crib.insert(theirs);
+      while (auto cut = remaining_deck.take()) {
+        row.tally.increment(score_crib<Rules>(crib, cut));
+        ++row.num_hands;
+      }
+    });
+    assert(row.num_hands == num_combinations(deck.size(), 2) * int(deck.size() - 2));
+  });
+
+  for (size_t i = 0; i < rows.size(); ++i) {
+    if (rows[i].discard.overlaps(held))
+      continue;
+    rows[i].tally = classes[row_class[i]].tally;
+    rows[i].num_hands = classes[row_class[i]].num_hands;
+  }
+  return rows;
+}
+
+/* CSV has one line per possible discard: the two cards, the number of
+   cribs, the mean crib score and the count of each crib score 0..29.
+
+   The binary form is dense: the magic "CRIBTAB1", the held cards as a
+   uint64_t, then for each of the 1,326 discards (in `for_each_choice`
+   order) the 30 counts as uint32_t.  Discards that overlap the held cards
+   are all zeros. */
+constexpr int max_crib_score = 29;
+
+// The table for no held cards, from shared memory if it's been warmed
+std::vector<CribTableRow> unconditioned_crib_table(unsigned jobs);
+
+void print_crib_table(Hand held, Options const &options) {
+  auto const rows = held.size() ? crib_table(held, options.jobs)
+                                : unconditioned_crib_table(options.jobs);
+
+  if (options.binary) {
+    cout.write("CRIBTAB1", 8);
+    uint64_t bits = held.bits();
+    cout.write(reinterpret_cast<char const *>(&bits), sizeof bits);
+    for (auto &row : rows)
+      for (int score = 0; score <= max_crib_score; ++score) {
+        uint32_t count = row.tally.scores[score - Tally::min_score];
+        cout.write(reinterpret_cast<char const *>(&count), sizeof count);
+      }
+    cout.flush();
+    return;
+  }
+
+  cout << "card1,card2,cribs,mean";
+  for (int score = 0; score <= max_crib_score; ++score)
+    cout << ",n" << score;
+  cout << '\n';
+  for (auto &row : rows) {
+    if (row.num_hands == 0)
+      continue;
+    auto discard = row.discard;
+    auto card1 = discard.take();
+    auto card2 = discard.take();
+    Statistics st(row.tally, row.num_hands);
+    cout << card1 << ',' << card2 << ',' << row.num_hands << ','
+         << std::fixed << std::setprecision(4) << st.mean;
+    for (int score = 0; score <= max_crib_score; ++score)
+      cout << ',' << row.tally.scores[score - Tally::min_score];
+    cout << '\n';
+  }
+}
+
+// ---------------------------------------------------------------------------
+
+/* Enumerations over every four-card hand and cut, for tables too slow to
+   build in one go.  `--shard=I/N` takes the I'th of N equal slices of the
+   C(52,4) hands, and `--checkpoint=FILE` keeps the slice's progress in FILE
+   so an interrupted run picks up where it stopped.  The shards are
+   combined, and checked to cover every hand exactly once, by `--merge`.
+
+   A shard file is the magic "CRIBSHD1", a ShardHeader and the count of
+   each score 0..29 as uint64_t. */
+enum class Enumeration : uint32_t { hands, cribs };
+constexpr std::string_view enumeration_names[] = {"hands", "cribs"};
+
+constexpr size_t num_enumerated_hands = num_combinations(all_cards.size(), 4);
+constexpr int num_cuts = int(all_cards.size()) - 4;
+
+struct ShardHeader {
+  Enumeration kind;
+  uint32_t shard;
+  uint32_t num_shards;
+  uint32_t reserved;
+  uint64_t begin;   // the hands [begin, end) in for_each_choice order
+  uint64_t end;
+  uint64_t next;    // ...of which [begin, next) are counted
+};
+
+struct ShardFile {
+  ShardHeader header;
+  uint64_t counts[max_crib_score + 1];
+};
+
+ShardFile read_shard(std::string const &path) {
+  std::ifstream in(path, std::ios::binary);
+  char magic[8];
+  ShardFile file;
+  if (!in.read(magic, sizeof magic) || std::string_view(magic, sizeof magic) != "CRIBSHD1" ||
+      !in.read(reinterpret_cast<char *>(&file), sizeof file))
+    throw std::runtime_error("Not a shard file '" + path + '\'');
+  return file;
+}
+
+// Replace the file all at once, so a crash leaves the old one intact
+void write_shard(std::string const &path, ShardFile const &file) {
+  auto temp = path + ".tmp";
+  {
+    std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+    out.write("CRIBSHD1", 8);
+    out.write(reinterpret_cast<char const *>(&file), sizeof file);
+    if (!out.flush())
+      throw std::runtime_error("Can't write '" + temp + '\'');
+  }
+  if (std::rename(temp.c_str(), path.c_str()) != 0)
+    throw std::runtime_error("Can't rename '" + temp + "' to '" + path + '\'');
+}
+
+void print_score_counts(uint64_t const *counts) {
+  cout << "score,count\n";
+  for (int score = 0; score <= max_crib_score; ++score)
+    cout << score << ',' << counts[score] << '\n';
+}
+
+// Add the count of each score of the hands [begin, end) to `counts`
+void count_scores(Enumeration kind, uint64_t begin, uint64_t end, unsigned jobs,
+                  uint64_t *counts) {
+  constexpr size_t slice = 64;
+  auto const num_slices = (end - begin + slice - 1) / slice;
+  std::vector<Tally> tallies(num_slices);
+  parallel_for(num_slices, jobs, [&](size_t i) {
+    auto from = begin + i * slice;
+    for_each_choice(Hand{all_cards}, 4, from, std::min(from + slice, end), [&](Hand hand) {
+      Hand deck{all_cards};
+      deck.remove(hand);
+      while (auto cut = deck.take())
+        tallies[i].increment(kind == Enumeration::cribs
+                             ? score_crib<StandardRules>(hand, cut)
+                             : score_hold<StandardRules>(hand, cut));
+    });
+  });
+  for (auto &tally : tallies)
+    for (int score = 0; score <= max_crib_score; ++score)
+      counts[score] += uint64_t(tally.count(score));
+}
+
+void enumerate(Enumeration kind, Options const &options) {
+  if (options.shard >= options.num_shards)
+    throw std::runtime_error("No shard " + std::to_string(options.shard) + " of " +
+                             std::to_string(options.num_shards));
+  ShardFile file{{kind, options.shard, options.num_shards, 0,
+                  num_enumerated_hands * options.shard / options.num_shards,
+                  num_enumerated_hands * (options.shard + 1) / options.num_shards, 0},
+                 {}};
+  file.header.next = file.header.begin;
+
+  if (!options.checkpoint.empty() && std::ifstream(options.checkpoint)) {
+    auto saved = read_shard(options.checkpoint);
+    if (saved.header.kind != kind || saved.header.shard != options.shard ||
+        saved.header.num_shards != options.num_shards)
+      throw std::runtime_error("Checkpoint '" + options.checkpoint + "' is for another shard");
+    file = saved;
+  }
+
+  // Enough hands per checkpoint to keep every thread busy for a while
+  constexpr size_t batch = 4096;
+  while (file.header.next < file.header.end) {
+    auto const end = std::min<uint64_t>(file.header.next + batch, file.header.end);
+    count_scores(kind, file.header.next, end, options.jobs, file.counts);
+    file.header.next = end;
+    if (!options.checkpoint.empty())
+      write_shard(options.checkpoint, file);
+  }
+
+  if (options.checkpoint.empty())
+    print_score_counts(file.counts);
+}
+
+// Combine shard files into the whole table, checking that nothing is
+// missing, incomplete or counted twice
+void merge_shards(std::string_view paths) {
+  std::vector<ShardFile> shards;
+  while (!paths.empty()) {
+    auto comma = std::min(paths.find(','), paths.size());
+    shards.push_back(read_shard(std::string(paths.substr(0, comma))));
+    paths.remove_prefix(std::min(comma + 1, paths.size()));
+  }
+  if (shards.empty())
+    throw std::runtime_error("No shards to merge");
+  std::sort(shards.begin(), shards.end(), [](auto &a, auto &b) {
+    return a.header.shard < b.header.shard;
+  });
+
+  auto const &first = shards.front().header;
+  uint64_t counts[max_crib_score + 1] = {};
+  uint64_t covered = 0;
+  for (uint32_t i = 0; i < shards.size(); ++i) {
+    auto const &h = shards[i].header;
+    if (h.kind != first.kind || h.num_shards != first.num_shards)
+      throw std::runtime_error("Shards are from different enumerations");
+    if (h.shard != i || h.begin != covered)
+      throw std::runtime_error("Shard " + std::to_string(i) + " is missing or repeated");
+    if (h.next != h.end)
+      throw std::runtime_error("Shard " + std::to_string(i) + " is incomplete");
+    uint64_t total = 0;
+    for (int score = 0; score <= max_crib_score; ++score) {
+      counts[score] += shards[i].counts[score];
+      total += shards[i].counts[score];
+    }
+    if (total != (h.end - h.begin) * num_cuts)
+      throw std::runtime_error("Shard " + std::to_string(i) + " has the wrong count");
+    covered = h.end;
+  }
+  if (shards.size() != first.num_shards || covered != num_enumerated_hands)
+    throw std::runtime_error("Shards cover " + std::to_string(covered) + " of " +
+                             std::to_string(num_enumerated_hands) + " hands");
+
+  print_score_counts(counts);
+}
+
+// ---------------------------------------------------------------------------
+
+/* Queries over every hand and cut, like all the hands scoring 24 or more.
+
+   15s, pairs and runs depend only on the five ranks, so the 12,994,800
+   hands and cuts fall into 6,175 rank multisets (five of a kind can't be
+   dealt).  The score index keeps each multiset's points from the rank
+   table and the most it could score with the best suits: a flush of four
+   or five needs that many different ranks, and nobs needs a jack and
+   another rank.  It's sorted by that bound, so a threshold query expands
+   into suits and cuts only the multisets that come before the threshold,
+   and skips the rest without looking at them. */
+struct RankMultiset {
+  Rank ranks[5];
+  uint8_t points;                // from the rank table
+  uint8_t hold_bound;            // ...and the most flush and nobs could add
+  uint8_t crib_bound;
+};
+
+std::vector<RankMultiset> const &rank_multisets() {
+  static auto const multisets = [] {
+    std::vector<RankMultiset> v;
+    RankMultiset m{};
+    auto &r = m.ranks;
+    for (r[0] = 0; r[0] < num_ranks; ++r[0])
+    for (r[1] = r[0]; r[1] < num_ranks; ++r[1])
+    for (r[2] = r[1]; r[2] < num_ranks; ++r[2])
+    for (r[3] = r[2]; r[3] < num_ranks; ++r[3])
+    for (r[4] = r[3]; r[4] < num_ranks; ++r[4]) {
+      if (r[0] == r[4])
+        continue; // five of a kind
+      constexpr Rank jack = 10;
+      auto const distinct = 1 + (r[1] != r[0]) + (r[2] != r[1]) + (r[3] != r[2]) + (r[4] != r[3]);
+      auto const nobs = std::count(r, r + 5, jack) != 0;
+      m.points = rank_points[rank_multiset_index(r)];
+      m.hold_bound = uint8_t(m.points + (distinct == 5 ? 5 : distinct == 4 ? 4 : 0) + nobs);
+      m.crib_bound = uint8_t(m.points + (distinct == 5 ? 5 : 0) + nobs);
+      v.push_back(m);
+    }
+    return v;
+  }();
+  return multisets;
+}
+
+// The hands and cuts scoring in [at_least, at_most], as a hand or a crib
+struct ScoreQuery {
+  bool is_crib = false;
+  int at_least = 0;
+  int at_most = max_crib_score;
+};
+
+struct QueryMatch {
+  Hand hand;
+  Card cut;
+  int score;
+};
+
+// Call `func(hand, cut, score)` for each hand and cut that matches, in the
+// order of the index, on this thread.  The matches are found `jobs` rank
+// multisets at a time, a chunk at a time so they stream out as they're found.
+template <typename F>
+size_t for_each_query_match(ScoreQuery const &query, unsigned jobs, F const &func) {
+  auto const &multisets = rank_multisets();
+  auto const bound = [&](size_t i) {
+    return query.is_crib ? multisets[i].crib_bound : multisets[i].hold_bound;
+  };
+  std::vector<uint16_t> index(multisets.size());
+  std::iota(index.begin(), index.end(), 0);
+  std::stable_sort(index.begin(), index.end(), [&](auto a, auto b) { return bound(a) > bound(b); });
+  // Only these can reach the threshold, and only those with enough points can stay under the top
+  auto const searched = size_t(std::partition_point(index.begin(), index.end(), [&](auto i) {
+    return bound(i) >= query.at_least;
+  }) - index.begin());
+
+  constexpr size_t chunk = 256;
+  std::vector<std::vector<QueryMatch>> matches(chunk);
+  for (size_t begin = 0; begin < searched; begin += chunk) {
+    auto const n = std::min(chunk, searched - begin);
+    parallel_for(n, jobs, [&](size_t k) {
+      auto const &m = multisets[index[begin + k]];
+      auto &found = matches[k];
+      found.clear();
+      if (m.points > query.at_most)
+        return;
+      // Each rank takes as many different suits as it has cards
+      Hand five;
+      auto choose_suits = [&](auto &self, size_t i) -> void {
+        if (i == 5) {
+          for (Hand cards{five}; auto cut = cards.take();) {
+            Hand hand{five};
+            hand.remove(cut);
+            auto score = m.points + score_suits(hand, cut, query.is_crib);
+            if (score >= query.at_least && score <= query.at_most)
+              found.push_back({hand, cut, score});
+          }
+          return;
+        }
+        auto const count = size_t(std::count(m.ranks + i, m.ranks + 5, m.ranks[i]));
+        for (unsigned suits = 0; suits < 1u << num_suits; ++suits) {
+          if (size_t(std::popcount(suits)) != count)
+            continue;
+          for (Suit suit = 0; suit < num_suits; ++suit)
+            if (suits >> suit & 1)
+              five.insert(Card{m.ranks[i], suit});
+          self(self, i + count);
+          for (Suit suit = 0; suit < num_suits; ++suit)
+            if (suits >> suit & 1)
+              five.remove(Card{m.ranks[i], suit});
+        }
+      };
+      choose_suits(choose_suits, 0);
+    });
+    for (size_t k = 0; k < n; ++k)
+      for (auto const &match : matches[k])
+        func(match.hand, match.cut, match.score);
+  }
+  return searched;
+}
+
+// The cribs that score the most with `held` in hand and the cut: with a 29
+// hand, what's the most you could have in the crib?
+std::vector<Hand> best_cribs(Hand held, Card cut, unsigned jobs, int &best) {
+  Hand deck{all_cards};
+  deck.remove(held);
+  deck.remove(cut);
+  auto const num_cribs = uint64_t(num_combinations(deck.size(), 4));
+  constexpr uint64_t slice = 4096;
+  auto const num_slices = (num_cribs + slice - 1) / slice;
+  std::vector<std::pair<int, std::vector<Hand>>> slices(num_slices, {-1, {}});
+  parallel_for(num_slices, jobs, [&](size_t i) {
+    auto &[top, cribs] = slices[i];
+    auto const from = i * slice;
+    for_each_choice(deck, 4, from, std::min(from + slice, num_cribs), [&](Hand crib) {
+      auto const score = score_hand(crib, cut, true);
+      if (score > top) {
+        top = score;
+        cribs.clear();
+      }
+      if (score == top)
+        cribs.push_back(crib);
+    });
+  });
+  best = -1;
+  std::vector<Hand> cribs;
+  for (auto &[top, some] : slices) {
+    if (top > best) {
+      best = top;
+      cribs.clear();
+    }
+    if (top == best)
+      cribs.insert(cribs.end(), some.begin(), some.end());
+  }
+  return cribs;
+}
+
+/* `--query=hold>=24` prints every hand and cut scoring 24 or more, and
+   `crib>=K` every crib; `=K` is exactly K.  `--query=max-crib:CARDS`, with
+   four held cards and then the cut, prints the best cribs alongside them.
+   Both print `HAND + CUT = SCORE`. */
+void run_query(std::string_view query, Options const &options) {
+  auto &out = output();
+  auto const start = std::chrono::steady_clock::now();
+  size_t num_matches = 0;
+  std::string summary;
+  if (query.starts_with("max-crib:")) {
+    Card cut; // the last card given
+    auto cards = make_hand(query.substr(query.find(':') + 1), &cut);
+    if (cards.size() != 5)
+      throw std::runtime_error("Expected four held cards and a cut '" + std::string(query) + '\'');
+    cards.remove(cut);
+    int best;
+    for (auto crib : best_cribs(cards, cut, options.jobs, best)) {
+      out << crib << " + " << cut << " = " << best << '\n';
+      out.flush_if_full();
+      ++num_matches;
+    }
+    summary = std::to_string(num_combinations(all_cards.size() - 5, 4)) + " cribs";
+  } else {
+    ScoreQuery q;
+    auto const op = query.find('=');
+    auto what = query.substr(0, op);
+    auto const at_least = what.ends_with('>');
+    if (at_least)
+      what.remove_suffix(1);
+    auto const value = query.substr(op == query.npos ? query.size() : op + 1);
+    int k = 0;
+    auto const [end, ec] = std::from_chars(value.data(), value.data() + value.size(), k);
+    if (op == query.npos || (what != "hold" && what != "crib") || ec != std::errc{} ||
+        end != value.data() + value.size())
+      throw std::runtime_error("Unknown query '" + std::string(query) + '\'');
+    q.is_crib = what == "crib";
+    q.at_least = k;
+    q.at_most = at_least ? max_crib_score : k;
+    auto searched = for_each_query_match(q, options.jobs, [&](Hand hand, Card cut, int score) {
+      out << hand << " + " << cut << " = " << score << '\n';
+      out.flush_if_full();
+      ++num_matches;
+    });
+    summary = std::to_string(searched) + " of " + std::to_string(rank_multisets().size()) +
+              " rank multisets";
+  }
+  out.flush();
+  if (options.verbose)
+    std::clog << "query: " << num_matches << " matches from " << summary << " in "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(
+                   std::chrono::steady_clock::now() - start).count() << "ms\n";
+}
+
+// ---------------------------------------------------------------------------
+
+/* A model of which cards the opponent puts in the crib.  Rather than every
+   pair of unseen cards being equally likely, each pair is weighted by how
+   attractive it is to throw: into my crib the opponent prefers pairs with a
+   low expected crib score, into their own crib a high one.  The expected
+   crib score of a pair depends only on its ranks and whether it is suited,
+   so the weights are indexed by one of 169 compact keys: suited pairs at
+   [low][high], offsuit pairs at [high][low] and pocket pairs on the
+   diagonal. */
+constexpr size_t num_discard_keys = num_ranks * num_ranks;
+
+constexpr size_t discard_key(Hand pair) {
+  assert(pair.size() == 2);
+  auto a = pair.take();
+  auto b = pair.take();
+  auto lo = std::min(a.rank(), b.rank());
+  auto hi = std::max(a.rank(), b.rank());
+  if (a.suit() == b.suit())
+    return lo * num_ranks + hi;
+  return hi * num_ranks + lo;
+}
+
+static_assert(discard_key(make_hand("AS 2S")) == 1);
+static_assert(discard_key(make_hand("AS 2D")) == num_ranks);
+static_assert(discard_key(make_hand("KS KD")) == num_discard_keys - 1);
+
+// Each point of expected crib score changes the odds of a throw by e^0.5
+constexpr double opponent_rationality = 0.5;
+
+struct OpponentWeights {
+  uint16_t to_mine[num_discard_keys];   // the opponent throwing to my crib
+  uint16_t to_theirs[num_discard_keys]; // ...and to their own
+};
+
+OpponentWeights compute_opponent_weights(std::vector<CribTableRow> const &rows) {
+  double ev[num_discard_keys] = {};
+  for (auto &row : rows)
+    ev[discard_key(row.discard)] = Statistics(row.tally, row.num_hands).mean;
+  auto [lo, hi] = std::minmax_element(std::begin(ev), std::end(ev));
+  OpponentWeights w{};
+  for (size_t k = 0; k < num_discard_keys; ++k) {
+    auto scale = [](double x) {
+      return uint16_t(std::max(1.0, std::round(65535 * std::exp(x))));
+    };
+    w.to_mine[k] = scale(-opponent_rationality * (ev[k] - *lo));
+    w.to_theirs[k] = scale(opponent_rationality * (ev[k] - *hi));
+  }
+  return w;
+}
+
+// ---------------------------------------------------------------------------
+
+/* Tables that take a second or so to compute can be published once, with
+   `--warm`, into a POSIX shared memory segment that later processes map
+   read-only instead of recomputing them.  The segment starts with a header
+   that identifies its layout and a checksum of the tables; a process that
+   finds no segment, or one that doesn't check out, quietly computes the
+   tables itself.  `--verbose` reports which happened and how long it took.
+   A segment is never written once it's published: `--warm` unlinks the old
+   one and fills a new one under the same name, so processes that mapped
+   the old one keep it, whatever the new one's size.
+
+   The tables are small (about 160KB), so huge pages wouldn't help. */
+constexpr char shared_tables_name[] = "/cribbage-tables";
+constexpr uint64_t shared_tables_magic = 0x314d4853'42495243; // "CRIBSHM1"
+constexpr uint32_t shared_tables_version = 1; // bump when a table changes
+
+struct SharedTables {
+  uint64_t magic;         // written last, once the tables are complete
+  uint32_t version;
+  uint32_t size;          // of the whole segment
+  uint64_t checksum;      // of everything after the header
+  uint32_t crib_counts[num_combinations(52, 2)][max_crib_score + 1];
+  OpponentWeights weights;
+};
+
+struct SharedTablesStatus {
+  bool looked = false;    // whether anything needed the tables
+  bool attached = false;
+  double micros = 0;      // to attach
+};
+
+SharedTablesStatus shared_tables_status;
+
+// FNV-1a a word rather than a byte at a time, so attaching stays quick
+uint64_t shared_tables_checksum(SharedTables const &tables) {
+  auto const *start = reinterpret_cast<char const *>(&tables.crib_counts);
+  auto const *end = reinterpret_cast<char const *>(&tables + 1);
+  static_assert(sizeof(SharedTables) % sizeof(uint64_t) == 0);
+  uint64_t hash = 0xcbf29ce484222325;
+  for (auto p = start; p < end; p += sizeof(uint64_t)) {
+    uint64_t word;
+    std::memcpy(&word, p, sizeof word);
+    hash = (hash ^ word) * 0x100000001b3;
+  }
+  return hash;
+}
+
+// The segment, mapped read-only, or null if it isn't there or isn't right
+SharedTables const *shared_tables() {
+  static SharedTables const *const tables = []() -> SharedTables const * {
+    auto start = std::chrono::steady_clock::now();
+    shared_tables_status.looked = true;
+    int fd = ::shm_open(shared_tables_name, O_RDONLY, 0);
+    if (fd < 0)
+      return nullptr;
+    struct stat st;
+    void *p = MAP_FAILED;
+    if (::flock(fd, LOCK_SH) == 0 && ::fstat(fd, &st) == 0 &&
+        size_t(st.st_size) == sizeof(SharedTables))
+      p = ::mmap(nullptr, sizeof(SharedTables), PROT_READ, MAP_SHARED, fd, 0);
+    auto const *t = p == MAP_FAILED ? nullptr : static_cast<SharedTables const *>(p);
+    if (t && (t->magic != shared_tables_magic || t->version != shared_tables_version ||
+              t->size != sizeof(SharedTables) || t->checksum != shared_tables_checksum(*t))) {
+      ::munmap(p, sizeof(SharedTables));
+      t = nullptr;
+    }
+    ::close(fd); // which releases the lock; the mapping stays
+    shared_tables_status.attached = t != nullptr;
+    shared_tables_status.micros = std::chrono::duration<double, std::micro>(
+      std::chrono::steady_clock::now() - start).count();
+    return t;
+  }();
+  return tables;
+}
+
+std::vector<CribTableRow> unconditioned_crib_table(unsigned jobs) {
+  auto const *shared = shared_tables();
+  if (!shared)
+    return crib_table(Hand{}, jobs);
+  std::vector<CribTableRow> rows;
+  size_t i = 0;
+  for_each_choice(all_cards, 2, [&](Hand discard) {
+    CribTableRow row{discard, {}, 0};
+    for (int score = 0; score <= max_crib_score; ++score) {
+      auto count = int(shared->crib_counts[i][score]);
+      row.tally.add(score, count);
+      row.num_hands += count;
+    }
+    rows.push_back(row);
+    ++i;
+  });
+  return rows;
+}
+
+// Compute the tables and publish them for other processes
+void warm_shared_tables(Options const &options) {
+  auto start = std::chrono::steady_clock::now();
+  auto const rows = crib_table(Hand{}, options.jobs);
+
+  // A new segment, locked so readers wait for it rather than find it empty;
+  // another --warm can slip one in between the unlink and the create
+  auto fail = [](char const *what) {
+    return std::runtime_error(std::string(what) + " shared memory '" + shared_tables_name +
+                              "': " + std::strerror(errno));
+  };
+  int fd = -1;
+  for (int attempt = 0; fd < 0 && attempt < 3; ++attempt) {
+    if (::shm_unlink(shared_tables_name) != 0 && errno != ENOENT)
+      throw fail("Can't remove");
+    fd = ::shm_open(shared_tables_name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0 && errno != EEXIST)
+      break;
+  }
+  if (fd < 0)
+    throw fail("Can't create");
+  void *p = MAP_FAILED;
+  if (::flock(fd, LOCK_EX) == 0 && ::ftruncate(fd, sizeof(SharedTables)) == 0)
+    p = ::mmap(nullptr, sizeof(SharedTables), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (p == MAP_FAILED) {
+    auto error = fail("Can't fill");
+    ::shm_unlink(shared_tables_name);
+    ::close(fd);
+    throw error;
+  }
+  auto &tables = *static_cast<SharedTables *>(p);
+  tables.version = shared_tables_version;
+  tables.size = sizeof(SharedTables);
+  for (size_t i = 0; i < rows.size(); ++i)
+    for (int score = 0; score <= max_crib_score; ++score)
+      tables.crib_counts[i][score] = uint32_t(rows[i].tally.count(score));
+  tables.weights = compute_opponent_weights(rows);
+  tables.checksum = shared_tables_checksum(tables);
+  std::atomic_ref(tables.magic).store(shared_tables_magic, std::memory_order_release); // last
+  ::munmap(p, sizeof(SharedTables));
+  ::close(fd); // which releases the lock
+
+  if (options.verbose)
+    std::clog << "tables: warmed " << shared_tables_name << " in "
+              << std::chrono::duration<double, std::milli>(
+                   std::chrono::steady_clock::now() - start).count() << "ms\n";
+}
+
+// From the shared tables if they're there, else computed on first use
+OpponentWeights const &opponent_weights() {
+  if (auto const *shared = shared_tables())
+    return shared->weights;
+  static OpponentWeights const weights =
+    compute_opponent_weights(crib_table(Hand{}, default_jobs()));
+  return weights;
+}
+
+/* Call `func(discard, mine_tally, if_mine, theirs_tally, if_theirs)` for
+   each way of discarding to the crib, with the distribution of scores and
+   its statistics when the crib is mine and when it's theirs.  With the
+   opponent model the tallies are weighted.  The `dead` cards are known to
+   be out of play, so they're never in the crib or cut. */
+template <RulesPolicy Rules, bool opponent_model = false, typename T>
+void for_each_discard(Hand hand, Hand dead, T const &func) {
+  // Weighting needs to know which two crib cards the opponent threw
+  static_assert(!opponent_model || crib_unknown<Rules> == 2);
+  using Count = std::conditional_t<opponent_model, int64_t, int>;
+  auto const *weights = opponent_model ? &opponent_weights() : nullptr;
+
+  for_each_choice(hand, Rules::num_discards, [&](Hand discard) {
+    Hand hold{hand};
+    hold.remove(discard);
+
+    Hand deck{all_cards};
+    deck.remove(hand);
+    deck.remove(dead);
+    assert(deck.size() == deck_size<Rules> - dead.size());
+
+    BasicTally<Count> mine_tally;   // scores when the crib is mine
+    BasicTally<Count> theirs_tally; // scores then the crib is theirs
+    JointTally joint;               // ...both at once, when every crib counts the same
+    int num_hands = 0;
+    for_each_choice(deck, crib_unknown<Rules>, [&](Hand chosen) {
+      auto remaining_deck{deck};
+      remaining_deck.remove(chosen);
+      assert(remaining_deck.size() == deck.size() - crib_unknown<Rules>);
+
+      Count mine_weight = 1;
+      Count theirs_weight = 1;
+      if constexpr (opponent_model) {
+        auto key = discard_key(chosen);
+        mine_weight = weights->to_mine[key];
+        theirs_weight = weights->to_theirs[key];
+      }
+
+      Hand crib{discard};
+      crib.insert(chosen);
+      assert(crib.size() == 4);
+
+      while (auto cut = remaining_deck.take()) {
+        auto hold_score = score_hold<Rules>(hold, cut);
+        auto crib_score = score_crib<Rules>(crib, cut);
+
+        ++num_hands;
+
+        if constexpr (opponent_model) {
+          mine_tally.add(hold_score + crib_score, mine_weight);
+          theirs_tally.add(hold_score - crib_score, theirs_weight);
+        } else
+          joint.add(hold_score, crib_score);
+      }
+    });
+    if constexpr (!opponent_model) {
+      mine_tally = joint.mine();
+      theirs_tally = joint.theirs();
+    }
+    // standard deck size: 46, C(46,2)=1035, less any dead cards
+    // remaining_deck size: 44
+    static_assert(num_combinations(46, 2) == 1035);
+    assert(num_hands == num_combinations(deck.size(), crib_unknown<Rules>) *
+                        int(deck.size() - crib_unknown<Rules>));
+
+    /* Calculate statistics (mean, standard deviation, min and max)
+       for both situations when it's my crib and when it's theirs. */
+    if constexpr (opponent_model)
+      func(discard, mine_tally, Statistics::weighted(mine_tally),
+           theirs_tally, Statistics::weighted(theirs_tally));
+    else
+      func(discard, mine_tally, Statistics(mine_tally, num_hands),
+           theirs_tally, Statistics(theirs_tally, num_hands));
+  });
+}
+
+/* The same as `for_each_discard` without the opponent model, but keeping
+   what it counted for the last hand, so a hand that differs from it by a
+   card or two (as when a user edits a deal, or the dead cards) is cheap to
+   analyze.
+
+   For each discard and each cut it keeps how many cribs from the rest of
+   the deck score each amount.  When cards leave the deck, the cribs with
+   them are subtracted; when cards join it, the cribs with them are added.
+   A discard that wasn't in the last hand is counted from scratch.  The
+   hold scores are cheap, just one per cut, so they're always recomputed,
+   and the tallies are rebuilt from them and the crib counts. */
+template <RulesPolicy Rules>
+class IncrementalAnalysis {
+  using CribCounts = std::array<int, max_crib_score + 1>;
+  struct DiscardState {
+    Hand discard;
+    std::array<CribCounts, 64> by_cut; // by the cut's bit
+  };
+
+  // Beyond this many cards in or out of the deck, start over
+  static constexpr size_t max_changes = 8;
+
+  Hand deck_;                       // the deck the states were counted over
+  std::vector<DiscardState> states_;
+
+public:
+  unsigned updated = 0;   // discards brought up to date
+  unsigned recounted = 0; // ...and counted from scratch
+
+  template <typename T>
+  void for_each_discard(Hand hand, Hand dead, T const &func) {
+    Hand deck{all_cards};
+    deck.remove(hand);
+    deck.remove(dead);
+    Hand const removed{deck_.bits() & ~deck.bits()};
+    Hand const added{deck.bits() & ~deck_.bits()};
+    bool const incremental = removed.size() + added.size() <= max_changes;
+
+    std::vector<DiscardState> states;
+    states.reserve(num_combinations(Rules::deal_size, Rules::num_discards));
+    for_each_choice(hand, Rules::num_discards, [&](Hand discard) {
+      auto old = std::find_if(states_.begin(), states_.end(), [&](auto &state) {
+        return state.discard.bits() == discard.bits();
+      });
+      if (incremental && old != states_.end()) {
+        auto &state = states.emplace_back(std::move(*old));
+        Hand counted{deck_};
+        for (auto cards = removed; auto card = cards.take();)
+          remove_card(state, counted, card);
+        for (auto cards = added; auto card = cards.take();)
+          add_card(state, counted, card);
+        assert(counted.bits() == deck.bits());
+        ++updated;
+      } else {
+        count_cribs(states.emplace_back(DiscardState{discard, {}}), deck, +1);
+        ++recounted;
+      }
+      report(states.back(), hand, deck, func);
+    });
+    states_ = std::move(states);
+    deck_ = deck;
+  }
+
+private:
+  static size_t slot(Card card) {
+    return card.suit() * 16 + card.rank();
+  }
+
+  /* Add (or take away) the cribs from `deck` that include `with`, which
+     isn't in `deck`, with each cut from `deck` */
+  static void count_cribs(DiscardState &state, Hand deck, int sign, Hand with = Hand{}) {
+    for_each_choice(deck, crib_unknown<Rules> - with.size(), [&](Hand chosen) {
+      Hand crib{state.discard};
+      crib.insert(chosen);
+      crib.insert(with);
+      Hand cuts{deck};
+      cuts.remove(chosen);
+      while (auto cut = cuts.take())
+        state.by_cut[slot(cut)][score_crib<Rules>(crib, cut)] += sign;
+    });
+  }
+
+  // Count the cribs from `deck` with a cut that isn't in it
+  static void count_cut(DiscardState &state, Hand deck, Card cut) {
+    auto &counts = state.by_cut[slot(cut)];
+    counts = {};
+    for_each_choice(deck, crib_unknown<Rules>, [&](Hand chosen) {
+      Hand crib{state.discard};
+      crib.insert(chosen);
+      ++counts[score_crib<Rules>(crib, cut)];
+    });
+  }
+
+  static void remove_card(DiscardState &state, Hand &deck, Card card) {
+    state.by_cut[slot(card)] = {};
+    deck.remove(card);
+    Hand with;
+    with.insert(card);
+    count_cribs(state, deck, -1, with);
+  }
+
+  static void add_card(DiscardState &state, Hand &deck, Card card) {
+    Hand with;
+    with.insert(card);
+    count_cribs(state, deck, +1, with);
+    count_cut(state, deck, card);
+    deck.insert(card);
+  }
+
+  template <typename T>
+  static void report(DiscardState const &state, Hand hand, Hand deck, T const &func) {
+    Hand hold{hand};
+    hold.remove(state.discard);
+    JointTally joint;
+    int num_hands = 0;
+    while (auto cut = deck.take()) {
+      auto const hold_score = score_hold<Rules>(hold, cut);
+      auto const &counts = state.by_cut[slot(cut)];
+      for (int crib_score = 0; crib_score <= max_crib_score; ++crib_score) {
+        if (auto n = counts[crib_score]) {
+          joint.add(hold_score, crib_score, n);
+          num_hands += n;
+        }
+      }
+    }
+    auto const mine_tally = joint.mine();
+    auto const theirs_tally = joint.theirs();
+    func(state.discard, mine_tally, Statistics(mine_tally, num_hands),
+         theirs_tally, Statistics(theirs_tally, num_hands));
+  }
+};
+
+#ifdef CRIBBAGE_COUNTERS
+// What the scorers did since the last report, which starts them again
+void report_counters(Hand discard) {
+  auto &c = scorer_counters;
+  auto const calls = c.hands + c.cribs;
+  auto percent = [](uint64_t n, uint64_t of) {
+    return of ? 100.0 * double(n) / double(of) : 0.0;
+  };
+  std::clog << std::fixed << std::setprecision(1) << "counters " << discard << ": score_hand "
+            << c.hands << " hands " << c.cribs << " cribs, score_hand_generic "
+            << c.generic << "\n  15s " << percent(c.fifteens, c.subsets) << "% of "
+            << c.subsets << " subsets, pairs " << percent(c.pairs, c.pair_checks) << "% of "
+            << c.pair_checks << ", nobs " << percent(c.nobs, calls) << "%\n  runs ("
+            << c.patterns << " patterns tried)";
+  for (size_t i = 0; i <= std::size(run_patterns); ++i)
+    if (c.runs[i])
+      std::clog << ' ' << (i < std::size(run_patterns) ? run_patterns[i].name : "none")
+                << '=' << percent(c.runs[i], calls) << '%';
+  std::clog << "\n  flush";
+  for (size_t i = 0; i < std::size(flush_exits); ++i)
+    std::clog << ' ' << flush_exits[i] << '=' << percent(c.flushes[i], calls) << '%';
+  std::clog << '\n';
+  c = {};
+}
+#endif
+
+template <RulesPolicy Rules, bool opponent_model = false>
+void analyze_hand(Hand hand, Options const &options) {
+  /*
+    Find all possible ways to discard to the crib.
+    There are C(6,2)=15 possible discards in a standard cribbage hand.
+   */
+  auto &out = output();
+  out << "[ " << hand << " ]\n";
+  assert(hand.size() == Rules::deal_size);
+
+  // The cache and a --use-table table have the statistics but not the
+  // whole distribution
+  bool const use_cache = options.cache && !options.distribution;
+  // (The opponent model is 2: its results at 1 had unweighted stdevs)
+  constexpr uint64_t cache_mode = fnv1a(Rules::name) + (opponent_model ? 2 : 0);
+  // A table's mode includes the dead cards, which the cache keys separately
+  auto const dead_bits = options.dead.bits();
+  auto const table_mode = dead_bits ? fnv1a(&dead_bits, sizeof dead_bits, cache_mode) : cache_mode;
+  auto found = options.use_table && !options.distribution
+    ? options.use_table->lookup(hand, table_mode) : std::nullopt;
+  if (!found && use_cache)
+    found = options.cache->lookup(hand, options.dead, cache_mode);
+  if (found) {
+    for_each_choice(hand, Rules::num_discards, [&](Hand discard) {
+      auto r = std::find_if(found->begin(), found->end(), [&](auto &r) {
+        return r.discard.bits() == discard.bits();
+      });
+      assert(r != found->end());
+      out << discard << " [" << r->if_mine << ']' << " [" << r->if_theirs << "]\n";
+    });
+    if (options.table)
+      options.table->add(hand, Rules::num_discards, table_mode, options.dead, *found);
+    out << '\n';
+    out.flush_if_full();
+    return;
+  }
+  std::vector<DiscardResult> results;
+#ifdef CRIBBAGE_COUNTERS
+  scorer_counters = {};
+#endif
+  auto report = [&](Hand discard, auto const &mine_tally, Statistics if_mine,
+                    auto const &theirs_tally, Statistics if_theirs) {
+#ifdef CRIBBAGE_COUNTERS
+    report_counters(discard);
+#endif
+    out << discard << " [" << if_mine << ']' << " [" << if_theirs << "]\n";
+    if (options.distribution) {
+      print_distribution(out, "mine", mine_tally, options);
+      print_distribution(out, "theirs", theirs_tally, options);
+    }
+    results.push_back({discard, if_mine, if_theirs});
+  };
+  if constexpr (opponent_model)
+    for_each_discard<Rules, true>(hand, options.dead, report);
+  else {
+    thread_local IncrementalAnalysis<Rules> incremental;
+    incremental.for_each_discard(hand, options.dead, report);
+  }
+  if (use_cache)
+    options.cache->store(hand, options.dead, cache_mode, results);
+  if (options.table)
+    options.table->add(hand, Rules::num_discards, table_mode, options.dead, results);
+  out << '\n';
+  out.flush_if_full();
+}
+
+// ---------------------------------------------------------------------------
+
+/* Lockstep analysis of several deals at once.  Every standard deal runs the
+   same loops, 15 discards by 1035 crib pairs by 44 cuts, differing only in
+   which cards sit at each position.  So the cards are laid out by position
+   with one lane per deal, and the scorers below are written as straight-line
+   arithmetic over the lanes, with no branches or table lookups, which the
+   compiler turns into vector code.  Dead cards shrink every lane's deck
+   alike, so the lanes stay in step.  Each lane keeps its own tallies, and the
+   output is the same as running `analyze_hand` on each deal in turn. */
+constexpr size_t num_lanes = 8;
+
+// One card position in every lane, in the form the lane scorers want
+struct CardLanes {
+  int32_t value[num_lanes];
+  uint32_t rank[num_lanes]; // 1 << rank
+  uint32_t suit[num_lanes]; // 1 << suit
+  uint32_t nob[num_lanes];  // 1 << suit for a jack, else 0
+};
+
+constexpr void set_lane(CardLanes &lanes, size_t lane, Card card) {
+  constexpr Rank jack = 10;
+  lanes.value[lane] = card.value();
+  lanes.rank[lane] = 1u << card.rank();
+  lanes.suit[lane] = 1u << card.suit();
+  lanes.nob[lane] = card.rank() == jack ? lanes.suit[lane] : 0;
+}
+
+// Everything about four cards that doesn't depend on the cut
+struct FourCardLanes {
+  int32_t sums[15][num_lanes];   // of each nonempty subset
+  int32_t points[num_lanes];     // 15s and pairs among the four
+  uint32_t rank[4][num_lanes];
+  uint32_t ranks[num_lanes];     // all four rank bits
+  uint32_t pairs[6][num_lanes];  // the rank bit of each matching pair, else 0
+  uint32_t flush[num_lanes];     // the suit bit if all four share it, else 0
+  uint32_t nobs[num_lanes];      // suit bits of any jacks
+};
+
+constexpr void make_four(FourCardLanes &four, CardLanes const &a, CardLanes const &b,
+                         CardLanes const &c, CardLanes const &d) {
+  CardLanes const *cards[] = {&a, &b, &c, &d};
+  for (size_t l = 0; l < num_lanes; ++l) {
+    four.points[l] = 0;
+    four.ranks[l] = 0;
+    four.flush[l] = ~0u;
+    four.nobs[l] = 0;
+  }
+  for (unsigned subset = 1; subset < 16; ++subset)
+    for (size_t l = 0; l < num_lanes; ++l) {
+      int32_t sum = 0;
+      for (size_t i = 0; i < 4; ++i)
+        sum += (subset >> i & 1) ? cards[i]->value[l] : 0;
+      four.sums[subset - 1][l] = sum;
+      four.points[l] += 2 * (sum == 15);
+    }
+  for (size_t i = 0, k = 0; i < 4; ++i) {
+    for (size_t l = 0; l < num_lanes; ++l) {
+      four.rank[i][l] = cards[i]->rank[l];
+      four.ranks[l] |= cards[i]->rank[l];
+      four.flush[l] &= cards[i]->suit[l];
+      four.nobs[l] |= cards[i]->nob[l];
+    }
+    for (size_t j = i + 1; j < 4; ++j, ++k)
+      for (size_t l = 0; l < num_lanes; ++l) {
+        bool pair = cards[i]->rank[l] == cards[j]->rank[l];
+        four.pairs[k][l] = pair ? cards[i]->rank[l] : 0;
+        four.points[l] += 2 * pair;
+      }
+  }
+}
+
+/* The score of four cards plus the cut in each lane.  Runs are found from
+   the rank bits: at most one run of three or more fits in five cards.  Its
+   length is the number of cards in it less the duplicates, and the number of
+   pairs in it tells how many times it counts: once, twice, three times for
+   three of a kind or four times for two pairs. */
+constexpr void score_lanes(FourCardLanes const &four, CardLanes const &cut,
+                           bool is_crib, int32_t *score) {
+  for (size_t l = 0; l < num_lanes; ++l) {
+    auto const value = cut.value[l];
+    auto const rank = cut.rank[l];
+    auto const suit = cut.suit[l];
+
+    int32_t fifteens = 0;
+    for (size_t s = 0; s < 15; ++s)
+      fifteens += four.sums[s][l] + value == 15;
+
+    auto const ranks = four.ranks[l] | rank;
+    auto const run3 = ranks & ranks >> 1 & ranks >> 2;
+    auto const run = run3 | run3 << 1 | run3 << 2;
+    int32_t pairs = 0;
+    int32_t in_run = (rank & run) != 0;
+    int32_t run_pairs = 0;
+    for (size_t i = 0; i < 4; ++i) {
+      bool pair = four.rank[i][l] == rank;
+      pairs += pair;
+      in_run += (four.rank[i][l] & run) != 0;
+      run_pairs += pair && (rank & run) != 0;
+    }
+    for (size_t k = 0; k < 6; ++k)
+      run_pairs += (four.pairs[k][l] & run) != 0;
+    int32_t length = in_run - run_pairs + (run_pairs == 3);
+    int32_t times = 1 + run_pairs + (run_pairs >= 2) - 2 * (run_pairs == 3);
+
+    auto const flush = four.flush[l];
+    int32_t flush_points = is_crib ? 5 * ((flush & suit) != 0)
+                                   : (flush != 0) * (4 + ((flush & suit) != 0));
+
+    score[l] = four.points[l] + 2 * (fifteens + pairs) + length * times +
+               flush_points + ((four.nobs[l] & suit) != 0);
+  }
+}
+
+static_assert([] {
+  for (auto [hand, cut, is_crib] : {std::tuple{"5H 5C 5S JD", "5D", false},
+                                    {"AH 2H 3H 3S", "3D", false},
+                                    {"7H 7S 7C 8D", "8H", false},
+                                    {"AH 3H 7H TH", "JS", true},
+                                    {"AH 3H 7H TH", "JS", false},
+                                    {"6C 4D 6D 4S", "5D", false},
+                                    {"3C 4D 4C 5S", "5D", false},
+                                    {"JH QH AH 2H", "3H", true}}) {
+    CardLanes cards[5] = {};
+    auto h = make_hand(hand);
+    for (auto &card : cards)
+      set_lane(card, 0, &card == &cards[4] ? make_card(cut) : h.take());
+    FourCardLanes four{};
+    make_four(four, cards[0], cards[1], cards[2], cards[3]);
+    int32_t score[num_lanes];
+    score_lanes(four, cards[4], is_crib, score);
+    if (score[0] != score_hand(hand, cut, is_crib))
+      return false;
+  }
+  return true;
+}());
+
+template <typename Rules>
+concept LockstepRules = RulesPolicy<Rules> && Rules::num_players == 2 && hold_size<Rules> == 4 &&
+                        Rules::num_discards == 2 && crib_unknown<Rules> == 2;
+
+// Up to `num_lanes` deals, returning what `analyze_hand` would print
+template <RulesPolicy Rules> requires LockstepRules<Rules>
+std::string analyze_lanes(std::span<const Hand> hands, Options const &options) {
+  assert(!hands.empty() && hands.size() <= num_lanes);
+  constexpr size_t max_deck = deck_size<Rules>;
+  size_t const num_deck = max_deck - options.dead.size();
+  CardLanes deal[Rules::deal_size];
+  CardLanes deck[max_deck];
+  for (size_t l = 0; l < num_lanes; ++l) {
+    auto hand = hands[std::min(l, hands.size() - 1)]; // spare lanes repeat
+    Hand rest{all_cards};
+    rest.remove(hand);
+    rest.remove(options.dead);
+    assert(rest.size() == num_deck);
+    for (auto &card : deal)
+      set_lane(card, l, hand.take());
+    for (size_t i = 0; i < num_deck; ++i)
+      set_lane(deck[i], l, rest.take());
+  }
+
+  Writer out[num_lanes];
+  for (size_t l = 0; l < hands.size(); ++l)
+    out[l] << "[ " << hands[l] << " ]\n";
+
+  // The discards in `for_each_choice` order, as positions in the deal
+  for (size_t a = 0; a < Rules::deal_size; ++a)
+    for (size_t b = a + 1; b < Rules::deal_size; ++b) {
+      CardLanes const *hold[4];
+      for (size_t i = 0, n = 0; i < Rules::deal_size; ++i)
+        if (i != a && i != b)
+          hold[n++] = &deal[i];
+
+      FourCardLanes four;
+      make_four(four, *hold[0], *hold[1], *hold[2], *hold[3]);
+      int32_t hold_scores[max_deck][num_lanes];
+      for (size_t cut = 0; cut < num_deck; ++cut)
+        score_lanes(four, deck[cut], false, hold_scores[cut]);
+
+      JointTally joint[num_lanes];
+      for (size_t i = 0; i < num_deck; ++i)
+        for (size_t j = i + 1; j < num_deck; ++j) {
+          make_four(four, deal[a], deal[b], deck[i], deck[j]);
+          for (size_t cut = 0; cut < num_deck; ++cut) {
+            if (cut == i || cut == j)
+              continue;
+            int32_t crib_scores[num_lanes];
+            score_lanes(four, deck[cut], !Rules::crib_four_flush, crib_scores);
+            for (size_t l = 0; l < num_lanes; ++l)
+              joint[l].add(hold_scores[cut][l], crib_scores[l]);
+          }
+        }
+
+      int const num_hands = int(num_combinations(num_deck, 2) * (num_deck - 2));
+      for (size_t l = 0; l < hands.size(); ++l) {
+        auto const mine = joint[l].mine();
+        auto const theirs = joint[l].theirs();
+        auto cards = hands[l];
+        Hand discard;
+        for (size_t i = 0; i < Rules::deal_size; ++i) {
+          auto card = cards.take();
+          if (i == a || i == b)
+            discard.insert(card);
+        }
+        out[l] << discard << " [" << Statistics(mine, num_hands) << ']'
+               << " [" << Statistics(theirs, num_hands) << "]\n";
+        if (options.distribution) {
+          print_distribution(out[l], "mine", mine, options);
+          print_distribution(out[l], "theirs", theirs, options);
+        }
+      }
+    }
+
+  std::string result;
+  for (size_t l = 0; l < hands.size(); ++l)
+    (result += out[l].view()) += '\n';
+  return result;
+}
+
+// Analyze many deals, a group of `num_lanes` on each thread at a time
+template <RulesPolicy Rules> requires LockstepRules<Rules>
+void analyze_hands(std::span<const Hand> hands, Options const &options) {
+  auto const num_groups = (hands.size() + num_lanes - 1) / num_lanes;
+  std::vector<std::string> reports(num_groups);
+  parallel_for(num_groups, options.jobs, [&](size_t g) {
+    auto first = g * num_lanes;
+    reports[g] = analyze_lanes<Rules>(
+      hands.subspan(first, std::min(num_lanes, hands.size() - first)), options);
+  });
+  for (auto &report : reports) {
+    output() << report;
+    output().flush_if_full();
+  }
+}
+
+// ---------------------------------------------------------------------------
+
+/* Hold-only analysis: the distribution of each hold's hand score over every
+   cut, ignoring the crib.  That's 46 cuts per discard instead of 1035*44,
+   for callers who need an answer in microseconds. */
+struct HoldResult {
+  Hand discard;
+  Tally tally;
+  int num_hands = 0;
+};
+
+template <RulesPolicy Rules>
+using HoldResults =
+  std::array<HoldResult, num_combinations(Rules::deal_size, Rules::num_discards)>;
+
+template <RulesPolicy Rules>
+HoldResults<Rules> analyze_hold(Hand hand, Hand dead) {
+  assert(hand.size() == Rules::deal_size);
+  Hand deck{all_cards};
+  deck.remove(hand);
+  deck.remove(dead);
+
+  HoldResults<Rules> results;
+  size_t i = 0;
+  for_each_choice(hand, Rules::num_discards, [&](Hand discard) {
+    auto &result = results[i++];
+    result.discard = discard;
+    Hand hold{hand};
+    hold.remove(discard);
+    auto cuts{deck};
+    while (auto cut = cuts.take()) {
+      result.tally.increment(score_hold<Rules>(hold, cut));
+      ++result.num_hands;
+    }
+    assert(size_t(result.num_hands) == deck.size());
+  });
+  assert(i == results.size());
+  return results;
+}
+
+template <RulesPolicy Rules>
+void analyze_hold_only(Hand hand, Options const &options) {
+  auto &out = output();
+  out << "[ " << hand << " ]\n";
+  for (auto &result : analyze_hold<Rules>(hand, options.dead)) {
+    out << result.discard << " [" << Statistics(result.tally, result.num_hands)
+        << "] {" << result.tally << "}\n";
+    if (options.distribution)
+      print_distribution(out, "hold", result.tally, options);
+  }
+  out << '\n';
+  out.flush_if_full();
+}
+
+/* An estimate of `analyze_hand` from `--samples` (2000) cribs and cuts for
+   each discard, drawn at random, rather than all of them: about a ninth
+   of the time for a mean that's usually within a tenth of a point.  The draws
+   are seeded by the deal, so a deal's estimate is always the same. */
+template <RulesPolicy Rules>
+void analyze_sampled(Hand hand, Options const &options) {
+  auto &out = output();
+  out << "[ " << hand << " ]\n";
+  Hand deck{all_cards};
+  deck.remove(hand);
+  deck.remove(options.dead);
+  Card cards[52];
+  size_t num_cards = 0;
+  while (auto card = deck.take())
+    cards[num_cards++] = card;
+  constexpr size_t drawn = crib_unknown<Rules> + 1; // the rest of the crib, and the cut
+  assert(num_cards >= drawn);
+
+  uint64_t state = hand.bits() ^ options.dead.bits();
+  auto random = [&](size_t n) { // 0..n-1
+    state = state * 6364136223846793005 + 1442695040888963407;
+    return size_t((state >> 32) * n >> 32);
+  };
+  int const samples = options.samples > 0 ? options.samples : 2000;
+  int const num_hands = num_combinations(num_cards, crib_unknown<Rules>) *
+                        int(num_cards - crib_unknown<Rules>);
+  for_each_choice(hand, Rules::num_discards, [&](Hand discard) {
+    Hand hold{hand};
+    hold.remove(discard);
+    Tally mine_tally;
+    Tally theirs_tally;
+    for (int i = 0; i < samples; ++i) {
+      // A partial shuffle puts a random crib and cut at the front
+      for (size_t j = 0; j < drawn; ++j)
+        std::swap(cards[j], cards[j + random(num_cards - j)]);
+      Hand crib{discard};
+      for (size_t j = 0; j < crib_unknown<Rules>; ++j)
+        crib.insert(cards[j]);
+      auto const cut = cards[crib_unknown<Rules>];
+      auto const hold_score = score_hold<Rules>(hold, cut);
+      auto const crib_score = score_crib<Rules>(crib, cut);
+      mine_tally.increment(hold_score + crib_score);
+      theirs_tally.increment(hold_score - crib_score);
+    }
+    // The spread is over as many hands as an exact analysis counts, to compare with it
+    out << discard << " [" << Statistics(mine_tally, samples, num_hands) << "] ["
+        << Statistics(theirs_tally, samples, num_hands) << "]\n";
+    if (options.distribution) {
+      print_distribution(out, "mine", mine_tally, options);
+      print_distribution(out, "theirs", theirs_tally, options);
+    }
+  });
+  out << '\n';
+  out.flush_if_full();
+}
+
+/* Head to head: the net score, ours less the opponent's, rather than ours
+   alone.  It's our hold and the crib, if it's ours, less their hold and the
+   crib, if it's theirs, so it runs from -53 to 53.  The opponent discards
+   the way the crib table suggests: the hold with the best average over the
+   cuts, plus the expected crib score of the throw into their own crib, or
+   less it into ours.
+
+   Every opponent deal would be C(46,6) = 9,366,819 of them, so `--samples`
+   (20,000) are drawn, stratified by how many fives and ten-cards they hold,
+   which make the most fifteens.  Each stratum gets its share of the samples
+   and is weighted by its exact probability, which leaves less noise than
+   drawing from all the deals at once.  All of our discards are scored
+   against the same opponent deals, so the differences between them are
+   less noisy still.  The deals are drawn in blocks seeded by our deal, so
+   the results don't depend on `--jobs`. */
+using NetTally = BasicTally<double, -53, 53>;
+
+template <RulesPolicy Rules>
+void analyze_head_to_head(Hand hand, Options const &options) {
+  static_assert(Rules::num_players == 2 && Rules::num_discards == 2 &&
+                Rules::crib_from_deck == 0);
+  constexpr size_t num_throws = num_combinations(Rules::deal_size, Rules::num_discards);
+  auto &out = output();
+  out << "[ " << hand << " ]\n";
+
+  // The opponent's table: the expected crib score of each throw, as a crib
+  // scores under these rules.  Only a four-card flush changes that, so the
+  // others share the standard table, which may be in shared memory.
+  static auto const crib_means = [&] {
+    std::array<double, num_discard_keys> means{};
+    auto const rows = Rules::crib_four_flush == StandardRules::crib_four_flush
+      ? unconditioned_crib_table(options.jobs)
+      : crib_table<Rules>(Hand{}, options.jobs);
+    for (auto &row : rows)
+      means[discard_key(row.discard)] = Statistics(row.tally, row.num_hands).mean;
+    return means;
+  }();
+
+  Hand deck{all_cards};
+  deck.remove(hand);
+  deck.remove(options.dead);
+  assert(deck.size() >= 2 * Rules::deal_size);
+
+  // Our holds' scores with each cut, by the cut's bit
+  Hand discards[num_throws];
+  std::array<std::array<uint8_t, 64>, num_throws> hold_scores{};
+  {
+    size_t i = 0;
+    for_each_choice(hand, Rules::num_discards, [&](Hand discard) {
+      Hand hold{hand};
+      hold.remove(discard);
+      for (Hand cuts{deck}; auto cut = cuts.take();)
+        hold_scores[i][cut.suit() * 16 + cut.rank()] = uint8_t(score_hold<Rules>(hold, cut));
+      discards[i++] = discard;
+    });
+  }
+
+  // The unseen cards by kind (fives, ten-cards, the rest), and the strata
+  // by how many of the first two kinds the opponent is dealt
+  std::array<std::vector<Card>, 3> kinds;
+  for (Hand cards{deck}; auto card = cards.take();)
+    kinds[card.rank() == 4 ? 0 : card.value() == 10 ? 1 : 2].push_back(card);
+  struct Stratum {
+    size_t fives;
+    size_t tens;
+    size_t begin;    // its samples, among all of them
+    double weight;   // of each sample: the stratum's probability over its samples
+  };
+  std::vector<Stratum> strata;
+  size_t const wanted = options.samples > 0 ? size_t(options.samples) : 20000;
+  size_t num_samples = 0;
+  for (size_t fives = 0; fives <= std::min(kinds[0].size(), Rules::deal_size); ++fives)
+    for (size_t tens = 0; tens <= std::min(kinds[1].size(), Rules::deal_size - fives); ++tens) {
+      auto const rest = Rules::deal_size - fives - tens;
+      if (rest > kinds[2].size())
+        continue;
+      auto const probability = double(num_combinations(kinds[0].size(), fives)) *
+                               double(num_combinations(kinds[1].size(), tens)) *
+                               double(num_combinations(kinds[2].size(), rest)) /
+                               double(num_combinations(deck.size(), Rules::deal_size));
+      auto const n = std::max<size_t>(1, size_t(std::llround(double(wanted) * probability)));
+      strata.push_back({fives, tens, num_samples, probability / double(n)});
+      num_samples += n;
+    }
+
+  constexpr size_t block = 1024;
+  auto const num_blocks = (num_samples + block - 1) / block;
+  // [block][our discard][0 if the crib is ours, 1 if theirs]
+  std::vector<std::array<std::array<NetTally, 2>, num_throws>> tallies(num_blocks);
+  parallel_for(num_blocks, options.jobs, [&](size_t b) {
+    auto &tally = tallies[b];
+    uint64_t state = (hand.bits() ^ options.dead.bits()) + b * 0x9e3779b97f4a7c15;
+    auto random = [&](size_t n) { // 0..n-1
+      state = state * 6364136223846793005 + 1442695040888963407;
+      return size_t((state >> 32) * n >> 32);
+    };
+    auto cards = kinds; // each block shuffles its own
+    auto stratum = std::upper_bound(strata.begin(), strata.end(), b * block,
+                                    [](size_t i, auto &s) { return i < s.begin; }) - 1;
+    for (auto i = b * block; i < std::min(num_samples, (b + 1) * block); ++i) {
+      if (stratum + 1 != strata.end() && i >= stratum[1].begin)
+        ++stratum;
+      // A partial shuffle of each kind deals the opponent their share of it
+      Hand theirs;
+      for (size_t kind = 0; kind < 3; ++kind) {
+        auto &from = cards[kind];
+        auto const n = kind == 0 ? stratum->fives
+                     : kind == 1 ? stratum->tens
+                                 : Rules::deal_size - stratum->fives - stratum->tens;
+        for (size_t j = 0; j < n; ++j) {
+          std::swap(from[j], from[j + random(from.size() - j)]);
+          theirs.insert(from[j]);
+        }
+      }
+
+      // Their throw, judged from what they can see: every cut but their own cards
+      Hand best[2]; // into our crib, and into theirs
+      double best_value[2] = {-HUGE_VAL, -HUGE_VAL};
+      for_each_choice(theirs, Rules::num_discards, [&](Hand discard) {
+        Hand hold{theirs};
+        hold.remove(discard);
+        Hand cuts{all_cards};
+        cuts.remove(theirs);
+        int sum = 0;
+        while (auto cut = cuts.take())
+          sum += score_hold<Rules>(hold, cut);
+        auto const hold_mean = double(sum) / double(deck_size<Rules>);
+        auto const crib_mean = crib_means[discard_key(discard)];
+        for (int side = 0; side < 2; ++side) {
+          auto const value = side ? hold_mean + crib_mean : hold_mean - crib_mean;
+          if (value > best_value[side]) {
+            best_value[side] = value;
+            best[side] = discard;
+          }
+        }
+      });
+
+      Hand cuts{deck};
+      cuts.remove(theirs);
+      for (int side = 0; side < 2; ++side) {
+        Hand their_hold{theirs};
+        their_hold.remove(best[side]);
+        for (Hand c{cuts}; auto cut = c.take();) {
+          auto const their_score = score_hold<Rules>(their_hold, cut);
+          auto const bit = cut.suit() * 16 + cut.rank();
+          for (size_t k = 0; k < num_throws; ++k) {
+            Hand crib{discards[k]};
+            crib.insert(best[side]);
+            auto const crib_score = score_crib<Rules>(crib, cut);
+            tally[k][side].add(hold_scores[k][bit] - their_score +
+                               (side ? -crib_score : crib_score), stratum->weight);
+          }
+        }
+      }
+    }
+  });
+
+  auto statistics = [](NetTally const &t) {
+    int min = t.max_score;
+    int max = t.min_score;
+    for (int score = t.min_score; score <= t.max_score; ++score)
+      if (t.count(score) > 0) {
+        min = std::min(min, score);
+        max = score;
+      }
+    return Statistics(t.mean(), t.stdev(), min, max);
+  };
+  for (size_t k = 0; k < num_throws; ++k) {
+    NetTally net[2];
+    for (auto &tally : tallies)
+      for (int side = 0; side < 2; ++side)
+        net[side] += tally[k][side];
+    out << discards[k] << " [" << statistics(net[0]) << "] [" << statistics(net[1]) << "]\n";
+    if (options.distribution) {
+      print_distribution(out, "mine", net[0], options);
+      print_distribution(out, "theirs", net[1], options);
+    }
+  }
+  out << '\n';
+  out.flush_if_full();
+}
+
+// ---------------------------------------------------------------------------
+
+using Analyzer = void (*)(Hand, Options const &);
+using BatchAnalyzer = void (*)(std::span<const Hand>, Options const &);
+
+// From the most thorough to the cheapest
+enum class Mode { head_to_head, exact, opponent_model, sampled, hold_only };
+constexpr std::string_view mode_names[] = {
+  "head-to-head", "exact", "opponent-model", "sampled", "hold-only"
+};
+constexpr size_t num_modes = std::size(mode_names);
+
+struct RuleVariant {
+  std::string_view name;
+  size_t deal_size;
+  size_t crib_unknown;
+  Analyzer analyze[num_modes]; // null if the mode doesn't apply to the rules
+  BatchAnalyzer analyze_batch;  // exact mode, many deals at once, if possible
+};
+
+template <RulesPolicy Rules>
+constexpr RuleVariant rule_variant() {
+  RuleVariant variant{Rules::name, Rules::deal_size, crib_unknown<Rules>, {}, nullptr};
+  variant.analyze[size_t(Mode::exact)] = analyze_hand<Rules>;
+  if constexpr (crib_unknown<Rules> == 2)
+    variant.analyze[size_t(Mode::opponent_model)] = analyze_hand<Rules, true>;
+  variant.analyze[size_t(Mode::sampled)] = analyze_sampled<Rules>;
+  if constexpr (Rules::num_players == 2 && Rules::crib_from_deck == 0)
+    variant.analyze[size_t(Mode::head_to_head)] = analyze_head_to_head<Rules>;
+  variant.analyze[size_t(Mode::hold_only)] = analyze_hold_only<Rules>;
+  if constexpr (LockstepRules<Rules>)
+    variant.analyze_batch = analyze_hands<Rules>;
+  return variant;
+}
+
+constexpr RuleVariant rule_variants[] = {
+  rule_variant<StandardRules>(),
+  rule_variant<ThreePlayerRules>(),
+  rule_variant<FiveCardRules>(),
+  rule_variant<CribFourFlushRules>(),
+};
+
+RuleVariant const &variant_for(std::string_view rules) {
+  for (auto& variant : rule_variants)
+    if (variant.name == rules)
+      return variant;
+  throw std::runtime_error("Unknown rules '" + std::string(rules) + '\'');
+}
+
+Analyzer analyzer_for(std::string_view rules, Mode mode) {
+  if (auto analyze = variant_for(rules).analyze[size_t(mode)])
+    return analyze;
+  throw std::runtime_error("Can't use " + std::string(mode_names[size_t(mode)]) +
+                           " with rules '" + std::string(rules) + '\'');
+}
+
+Hand make_deal(std::string_view rules, std::string_view str) {
+  auto hand = make_hand(str);
+  auto deal_size = variant_for(rules).deal_size;
+  if (hand.size() != deal_size)
+    throw std::runtime_error("Expected " + std::to_string(deal_size) +
+                             " cards '" + std::string(str) + '\'');
+  return hand;
+}
+
+// Dead cards can't be in the deal, and must leave a crib and a cut
+void check_dead(RuleVariant const &variant, Hand hand, Hand dead) {
+  if (auto both = hand.bits() & dead.bits()) {
+    Writer cards;
+    cards << Hand{both};
+    throw std::runtime_error("Dead cards in the deal '" + std::string(cards.view()) + '\'');
+  }
+  if (all_cards.size() - hand.size() - dead.size() <= variant.crib_unknown)
+    throw std::runtime_error("Too many dead cards to deal a crib and cut");
+}
+
+/* Call `func(hand)` for each deal in a file, one per line, skipping blank
+   lines and reporting bad ones on std::clog.  The file is mapped rather
+   than read and parsed a block of lines at a time, so the parser never
+   allocates.  Returns the number of bad lines. */
+template <typename F>
+size_t for_each_deal_in_file(std::string const &path, size_t deal_size, F const &func) {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  struct stat st;
+  if (fd < 0 || ::fstat(fd, &st) != 0) {
+    if (fd >= 0)
+      ::close(fd);
+    throw std::runtime_error("Can't open '" + path + "': " + std::strerror(errno));
+  }
+  size_t const size = size_t(st.st_size);
+  void *data = size ? ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : nullptr;
+  ::close(fd);
+  if (data == MAP_FAILED)
+    throw std::runtime_error("Can't map '" + path + "': " + std::strerror(errno));
+  struct Unmap {
+    void *data;
+    size_t size;
+    ~Unmap() { if (data) ::munmap(data, size); }
+  } unmap{data, size};
+
+  std::string_view text(static_cast<char const *>(data), size);
+  constexpr size_t block = 4096;
+  Hand hands[block];
+  HandError errors[block];
+  size_t line = 0;
+  size_t num_bad = 0;
+  while (!text.empty()) {
+    auto [lines, bytes] = parse_hands(text, deal_size, hands, errors);
+    text.remove_prefix(bytes);
+    for (size_t i = 0; i < lines; ++i, ++line) {
+      if (errors[i] == HandError::none)
+        func(hands[i]);
+      else if (errors[i] != HandError::empty) {
+        std::clog << path << ':' << line + 1 << ": "
+                  << hand_error_names[size_t(errors[i])] << '\n';
+        ++num_bad;
+      }
+    }
+  }
+  return num_bad;
+}
+
+/* A bounded lock-free queue for any number of producers and consumers
+   (Dmitry Vyukov's): each cell's sequence number says whether it's ready
+   to be written or read on the current lap, so a push or pop is one
+   compare-and-swap on the tail or head.  `try_push` fails when the queue
+   is full, which is how back-pressure reaches the producer.  `push` and
+   `pop` spin a little and then sleep until the cell they're waiting on
+   changes, so an idle thread doesn't hold a core. */
+template <typename T>
+class BoundedQueue {
+  struct Cell {
+    std::atomic<size_t> sequence;
+    T value;
+  };
+  std::unique_ptr<Cell[]> cells_;
+  size_t const mask_;
+  alignas(64) std::atomic<size_t> tail_{0}; // next to push
+  alignas(64) std::atomic<size_t> head_{0}; // next to pop
+
+public:
+  explicit BoundedQueue(size_t capacity) // a power of 2
+  : cells_{new Cell[capacity]}, mask_{capacity - 1} {
+    assert(std::has_single_bit(capacity));
+    for (size_t i = 0; i < capacity; ++i)
+      cells_[i].sequence.store(i, std::memory_order_relaxed);
+  }
+
+  bool try_push(T &value) {
+    auto pos = tail_.load(std::memory_order_relaxed);
+    for (;;) {
+      auto &cell = cells_[pos & mask_];
+      auto seq = cell.sequence.load(std::memory_order_acquire);
+      if (seq == pos) {
+        if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          cell.value = std::move(value);
+          cell.sequence.store(pos + 1, std::memory_order_release);
+          cell.sequence.notify_all();
+          return true;
+        }
+      } else if (seq < pos) {
+        return false; // full
+      } else {
+        pos = tail_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  bool try_pop(T &value) {
+    auto pos = head_.load(std::memory_order_relaxed);
+    for (;;) {
+      auto &cell = cells_[pos & mask_];
+      auto seq = cell.sequence.load(std::memory_order_acquire);
+      if (seq == pos + 1) {
+        if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          value = std::move(cell.value);
+          cell.sequence.store(pos + mask_ + 1, std::memory_order_release);
+          cell.sequence.notify_all();
+          return true;
+        }
+      } else if (seq < pos + 1) {
+        return false; // empty
+      } else {
+        pos = head_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  static constexpr int spins = 64; // yields before sleeping
+
+  void push(T &value) {
+    for (int i = 0; !try_push(value); ++i)
+      if (i < spins)
+        std::this_thread::yield();
+      else
+        wait(tail_, 0);
+  }
+
+  void pop(T &value) {
+    for (int i = 0; !try_pop(value); ++i)
+      if (i < spins)
+        std::this_thread::yield();
+      else
+        wait(head_, 1);
+  }
+
+private:
+  // Sleeps until the cell at `end` changes, unless it's already ready: its
+  // sequence is `end` plus `ready` (0 to push, 1 to pop).  If `end` has
+  // moved on since, the cell may have gone round a whole lap and not change
+  // again for another, so it returns to try again instead.  While `end`
+  // hasn't moved, the next change to the cell is the one waited for, and
+  // it's notified.
+  void wait(std::atomic<size_t> const &end, size_t ready) {
+    auto pos = end.load(std::memory_order_relaxed);
+    auto &cell = cells_[pos & mask_];
+    auto seq = cell.sequence.load(std::memory_order_acquire);
+    // The acquire pairs with the release that follows any move of `end`
+    // past `pos`, so if the cell has moved on, this sees that `end` has too
+    if (seq != pos + ready && end.load(std::memory_order_relaxed) == pos)
+      cell.sequence.wait(seq, std::memory_order_acquire);
+  }
+
+public:
+  // Only a snapshot while other threads are pushing and popping
+  size_t size() const {
+    return tail_.load(std::memory_order_relaxed) - head_.load(std::memory_order_relaxed);
+  }
+};
+
+/* `--pipeline --file=PATH`: this thread parses the file into groups of
+   deals, a pool of `--jobs` workers analyzes them, and a writer thread
+   prints the reports in the file's order, all at once.  They're connected
+   by bounded queues.  The writer holds reports that arrive early until
+   the ones before them are written, and the parser stays within `window`
+   groups of the writer, so memory stays bounded however slow any one
+   group is.  Each thread that has to wait sleeps.  A --table gets each
+   group's results from the writer too, so they're in the file's order.
+   Returns the number of bad lines. */
+struct PipelineGroup {
+  size_t seq = 0;
+  std::vector<Hand> deals; // none to tell a worker or the writer to stop
+  std::string report;
+  std::unique_ptr<StatsTable> table; // the group's results, for --table
+};
+
+size_t analyze_file_pipelined(std::string const &path, std::string_view rules, Mode mode,
+                              Options const &options) {
+  auto const &variant = variant_for(rules);
+  auto const analyze = analyzer_for(rules, mode);
+  auto const batch =
+    options.batch && mode == Mode::exact && !options.table && !options.use_table
+    ? variant.analyze_batch : nullptr;
+  constexpr size_t group_size = num_lanes;
+  constexpr size_t window = 64;
+  BoundedQueue<PipelineGroup> to_workers(window);
+  BoundedQueue<PipelineGroup> to_writer(window);
+
+  std::atomic<size_t> written{0};
+  std::atomic<bool> failed{false};
+  std::exception_ptr error;
+  std::mutex error_mutex;
+  auto fail = [&] {
+    std::lock_guard lock(error_mutex);
+    if (!error)
+      error = std::current_exception();
+    failed = true;
+  };
+
+  // Each worker analyzes a group at a time, one thread each, to its own Writer
+  auto worker = [&] {
+    Options local = options;
+    local.jobs = 1;
+    auto &out = output();
+    out.hold();
+    for (PipelineGroup group;;) {
+      to_workers.pop(group);
+      if (group.deals.empty())
+        return;
+      try {
+        if (!failed) {
+          if (options.table) {
+            group.table = std::make_unique<StatsTable>();
+            local.table = group.table.get();
+          }
+          if (batch)
+            batch(group.deals, local);
+          else
+            for (auto deal : group.deals)
+              analyze(deal, local);
+          group.report = out.view();
+        }
+      } catch (...) {
+        fail();
+      }
+      out.clear();
+      to_writer.push(group);
+    }
+  };
+
+  struct {
+    size_t max_workers_depth = 0;
+    size_t total_workers_depth = 0;
+    size_t max_writer_depth = 0;
+    size_t total_writer_depth = 0;
+    size_t max_held = 0;
+    size_t stalls = 0;
+  } stats;
+
+  auto writer = [&] {
+    auto &out = output();
+    std::vector<std::optional<PipelineGroup>> held(window);
+    size_t num_held = 0;
+    for (PipelineGroup group;;) {
+      to_writer.pop(group);
+      if (group.deals.empty())
+        break;
+      auto depth = to_writer.size() + 1;
+      stats.total_writer_depth += depth;
+      stats.max_writer_depth = std::max(stats.max_writer_depth, depth);
+      auto const slot = group.seq % window;
+      held[slot] = std::move(group);
+      stats.max_held = std::max(stats.max_held, ++num_held);
+      for (auto next = written.load(); held[next % window]; ++next) {
+        out << held[next % window]->report;
+        out.flush_if_full();
+        if (auto const &table = held[next % window]->table)
+          options.table->append(*table);
+        held[next % window].reset();
+        --num_held;
+        written = next + 1;
+        written.notify_one();
+      }
+    }
+    out.flush();
+  };
+
+  auto const start = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (unsigned j = 0; j < options.jobs; ++j)
+    threads.emplace_back(worker);
+  std::thread writer_thread(writer);
+
+  size_t num_deals = 0;
+  size_t seq = 0;
+  PipelineGroup group;
+  auto send = [&] {
+    for (int i = 0;; ++i) { // back-pressure from the writer
+      auto const done = written.load();
+      if (seq - done < window)
+        break;
+      stats.stalls += i == 0;
+      if (i < to_workers.spins)
+        std::this_thread::yield();
+      else
+        written.wait(done);
+    }
+    group.seq = seq++;
+    auto depth = to_workers.size() + 1;
+    stats.total_workers_depth += depth;
+    stats.max_workers_depth = std::max(stats.max_workers_depth, depth);
+    to_workers.push(group);
+    group = {};
+  };
+  size_t num_bad = 0;
+  try {
+    num_bad = for_each_deal_in_file(path, variant.deal_size, [&](Hand deal) {
+      if (failed)
+        throw std::runtime_error("Pipeline failed"); // stop parsing; the first error wins
+      check_dead(variant, deal, options.dead);
+      group.deals.push_back(deal);
+      ++num_deals;
+      if (group.deals.size() == group_size)
+        send();
+    });
+    if (!group.deals.empty())
+      send();
+  } catch (...) {
+    fail();
+  }
+
+  for (size_t j = 0; j < threads.size(); ++j) {
+    PipelineGroup stop;
+    to_workers.push(stop);
+  }
+  for (auto &thread : threads)
+    thread.join();
+  PipelineGroup stop; // every group has reached the writer
+  to_writer.push(stop);
+  writer_thread.join();
+  if (error)
+    std::rethrow_exception(error);
+
+  if (options.verbose) {
+    auto const seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    auto mean = [&](size_t total) { return seq ? double(total) / double(seq) : 0.0; };
+    std::clog << std::fixed << std::setprecision(1) << "pipeline: " << num_deals
+              << " deals in " << seconds * 1000 << "ms (" << double(num_deals) / seconds
+              << " deals/s), " << options.jobs << " workers, groups of " << group_size
+              << "\npipeline: to workers depth mean " << mean(stats.total_workers_depth)
+              << " max " << stats.max_workers_depth << ", to writer depth mean "
+              << mean(stats.total_writer_depth) << " max " << stats.max_writer_depth
+              << ", held for order max " << stats.max_held << ", parser stalls "
+              << stats.stalls << '\n';
+  }
+  return num_bad;
+}
+
+/* `--serve`: answer requests from stdin as they arrive, one per line, a
+   deal and optionally a deadline in milliseconds from its arrival (or else
+   `--deadline`).  `--jobs` workers take the request with the earliest
+   deadline first, and give it the most exact analysis expected to finish
+   in time: the current mode, else sampled cribs, else the hold alone.  How
+   long each takes is learned as they run.  A response is written as soon
+   as it's done, so not necessarily in order, and starts with the request's
+   line number, the analysis it got, and how long it took:
+
+     = 3 sampled 14.2ms of 20ms
+
+   "late" is added if it missed the deadline anyway.  A bad request gets
+   `= 3 error: ...` and the rest are still answered. */
+void serve_requests(std::string_view rules, Mode mode, Options const &options) {
+  using Clock = std::chrono::steady_clock;
+  auto const &variant = variant_for(rules);
+  std::vector<Mode> fidelities{mode}; // the analyses to try, most exact first
+  for (auto cheaper : {Mode::sampled, Mode::hold_only})
+    if (cheaper > mode)
+      fidelities.push_back(cheaper);
+  for (auto fidelity : fidelities)
+    analyzer_for(rules, fidelity);
+
+  struct Request {
+    size_t line;
+    Hand deal;
+    Clock::time_point arrived;
+    Clock::time_point deadline;
+    bool operator<(Request const &other) const { // for the earliest at the top
+      return deadline > other.deadline;
+    }
+  };
+  std::priority_queue<Request> requests;
+  bool closed = false;
+  std::mutex mutex; // for the requests and the stats
+  std::condition_variable ready;
+  std::mutex output_mutex;
+
+  // Each worker analyzes a request at a time on one thread; `options.jobs`
+  // is how many requests are in flight, not threads per request
+  Options worker_options = options;
+  worker_options.jobs = 1;
+
+  // What each analysis is expected to take, in seconds, a running average,
+  // starting from a deal with no dead cards done from scratch the way the
+  // workers do it, and kept out of the cache and table
+  double expected[num_modes] = {};
+  {
+    Options local = worker_options;
+    local.cache = nullptr;
+    local.table = nullptr;
+    local.distribution = false;
+    local.dead = Hand{};
+    Hand deal;
+    for (Hand cards{all_cards}; deal.size() < variant.deal_size;)
+      deal.insert(cards.take());
+    for (auto fidelity : fidelities) {
+      auto const start = Clock::now();
+      variant.analyze[size_t(fidelity)](deal, local);
+      expected[size_t(fidelity)] = std::chrono::duration<double>(Clock::now() - start).count();
+    }
+    output().clear();
+  }
+
+  struct {
+    size_t served[num_modes] = {};
+    size_t errors = 0;
+    size_t late = 0;
+    std::vector<double> latencies; // milliseconds
+  } stats;
+
+  // A --table gets each request's results in line order, whatever order
+  // they're answered in: each is analyzed into a table of its own, held
+  // until every line before it is done
+  std::map<size_t, std::unique_ptr<StatsTable>> done; // by line
+  size_t next_line = 1;
+  auto finish = [&](size_t line, std::unique_ptr<StatsTable> staged) { // with `mutex` held
+    if (!options.table)
+      return;
+    done.emplace(line, std::move(staged));
+    for (auto it = done.begin(); it != done.end() && it->first == next_line; ++next_line) {
+      if (it->second)
+        options.table->append(*it->second);
+      it = done.erase(it);
+    }
+  };
+
+  auto respond = [&](std::string_view tag, std::string_view report) {
+    std::lock_guard lock(output_mutex);
+    std::fwrite(tag.data(), 1, tag.size(), stdout);
+    std::fwrite(report.data(), 1, report.size(), stdout);
+    std::fflush(stdout);
+  };
+
+  auto worker = [&] {
+    Options local = worker_options;
+    auto &out = output();
+    out.hold();
+    for (;;) {
+      Request request;
+      Mode fidelity = fidelities.back();
+      {
+        std::unique_lock lock(mutex);
+        ready.wait(lock, [&] { return closed || !requests.empty(); });
+        if (requests.empty())
+          return;
+        request = requests.top();
+        requests.pop();
+        auto const now = Clock::now();
+        for (auto f : fidelities)
+          if (now + std::chrono::duration<double>(expected[size_t(f)]) <= request.deadline) {
+            fidelity = f;
+            break;
+          }
+      }
+
+      Writer tag;
+      tag << "= " << uint64_t(request.line) << ' ';
+      std::unique_ptr<StatsTable> staged;
+      if (options.table) {
+        staged = std::make_unique<StatsTable>();
+        local.table = staged.get();
+      }
+      auto const start = Clock::now();
+      try {
+        check_dead(variant, request.deal, local.dead);
+        variant.analyze[size_t(fidelity)](request.deal, local);
+      } catch (std::exception const &exc) {
+        out.clear();
+        tag << "error: " << std::string_view(exc.what()) << '\n';
+        respond(tag.view(), {});
+        std::lock_guard lock(mutex);
+        ++stats.errors;
+        finish(request.line, nullptr);
+        continue;
+      }
+      auto const finished = Clock::now();
+      auto const latency_ms =
+        std::chrono::duration<double, std::milli>(finished - request.arrived).count();
+      bool const late = finished > request.deadline;
+      tag << mode_names[size_t(fidelity)] << ' ';
+      tag.fixed(latency_ms, 1) << "ms";
+      if (request.deadline != Clock::time_point::max()) {
+        tag << " of ";
+        tag.fixed(std::chrono::duration<double, std::milli>(request.deadline -
+                                                            request.arrived).count(), 0) << "ms";
+      }
+      if (late)
+        tag << " late";
+      tag << '\n';
+      respond(tag.view(), out.view());
+      out.clear();
+
+      std::lock_guard lock(mutex);
+      auto &e = expected[size_t(fidelity)];
+      e += (std::chrono::duration<double>(finished - start).count() - e) / 4;
+      ++stats.served[size_t(fidelity)];
+      stats.late += late;
+      stats.latencies.push_back(latency_ms);
+      finish(request.line, std::move(staged));
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (unsigned j = 0; j < options.jobs; ++j)
+    threads.emplace_back(worker);
+
+  std::string line;
+  for (size_t line_number = 1; std::getline(std::cin, line); ++line_number) {
+    auto const arrived = Clock::now();
+    std::string_view text = line;
+    auto const last = text.find_last_of(" \t");
+    auto deadline_ms = options.deadline_ms;
+    try {
+      if (last != text.npos && !text.substr(last + 1).empty() &&
+          text.substr(last + 1).find_first_not_of("0123456789.") == text.npos) {
+        deadline_ms = std::stod(std::string(text.substr(last + 1)));
+        text = text.substr(0, last);
+      }
+      if (text.find_first_not_of(" \t\r") == text.npos) {
+        std::lock_guard lock(mutex);
+        finish(line_number, nullptr);
+        continue;
+      }
+      auto const deal = make_deal(rules, text);
+      auto const deadline = deadline_ms > 0
+        ? arrived + std::chrono::duration_cast<Clock::duration>(
+                      std::chrono::duration<double, std::milli>(deadline_ms))
+        : Clock::time_point::max();
+      {
+        std::lock_guard lock(mutex);
+        requests.push({line_number, deal, arrived, deadline});
+      }
+      ready.notify_one();
+    } catch (std::exception const &exc) {
+      Writer tag;
+      tag << "= " << uint64_t(line_number) << " error: " << std::string_view(exc.what()) << '\n';
+      respond(tag.view(), {});
+      std::lock_guard lock(mutex);
+      ++stats.errors;
+      finish(line_number, nullptr);
+    }
+  }
+  {
+    std::lock_guard lock(mutex);
+    closed = true;
+  }
+  ready.notify_all();
+  for (auto &thread : threads)
+    thread.join();
+
+  if (options.verbose) {
+    auto &latencies = stats.latencies;
+    std::sort(latencies.begin(), latencies.end());
+    // Nearest rank, rounding halves to even as the benchmark script does
+    auto percentile = [&](double p) {
+      auto const n = latencies.size();
+      auto const rank = std::max<size_t>(1, size_t(std::nearbyint(p * double(n))));
+      return n == 0 ? 0.0 : latencies[std::min(rank, n) - 1];
+    };
+    std::clog << std::fixed << std::setprecision(1) << "serve:";
+    for (auto fidelity : fidelities)
+      std::clog << ' ' << stats.served[size_t(fidelity)] << ' ' << mode_names[size_t(fidelity)];
+    std::clog << ", " << stats.errors << " errors, " << stats.late << " late, latency p50 "
+              << percentile(0.5) << "ms p99 " << percentile(0.99) << "ms max "
+              << percentile(1) << "ms\n";
+  }
 }
 
 } // namespace
 
+#ifdef CRIBBAGE_LIBRARY
+/* A C interface for building this file as a shared library, `make
+   libcribbage.so`, for use from other languages (see cribbage_native.py).
+   Hands are strings as on the command line.  Results go in flat arrays
+   owned by the caller, and errors are negative return values rather than
+   exceptions: -1 for a malformed hand, -3 for dead cards that are in the
+   hand or leave too few to deal, -2 for anything else. */
+extern "C" {
+
+// The score of a four-card hand or crib with the cut
+int cribbage_score_hand(char const *hand, char const *cut, int is_crib) {
+  Hand h, c;
+  if (parse_hand(hand, h) != HandError::none || h.size() != 4 ||
+      parse_hand(cut, c) != HandError::none || c.size() != 1 || (h.bits() & c.bits()))
+    return -1;
+  auto card = c.take();
+  return is_crib ? score_crib<StandardRules>(h, card) : score_hold<StandardRules>(h, card);
+}
+
+// How many of the C(52,4) * 48 hands (or cribs) have each score 0..29
+int cribbage_hand_distribution(int is_crib, unsigned jobs, uint64_t counts[30]) {
+  static_assert(max_crib_score + 1 == 30);
+  try {
+    std::fill_n(counts, max_crib_score + 1, 0);
+    count_scores(is_crib ? Enumeration::cribs : Enumeration::hands, 0, num_enumerated_hands,
+                 jobs ? jobs : default_jobs(), counts);
+    return 0;
+  } catch (...) {
+    return -2;
+  }
+}
+
+// The range of scores in the tallies from cribbage_analyze_hand
+int cribbage_min_score() { return Tally::min_score; }
+int cribbage_max_score() { return Tally::max_score; }
+
+/* Analyze a standard six-card deal as `cribbage-cpp` does, with any `dead`
+   cards (may be null) out of the deck, returning the number of discards,
+   15.  A deal a card or two away from the thread's last one is quick.
+   For each discard i:
+     discards[i] is its two cards, like "5H JD"
+     stats[i][0..3] is the mean, stdev, min and max when the crib is mine,
+     stats[i][4..7] the same when it's theirs
+     tallies, if not null, gets the weight of each score min..max when the
+     crib is mine at tallies[i][0] and when it's theirs at tallies[i][1] */
+int cribbage_analyze_hand(char const *hand, char const *dead, int opponent_model,
+                          char discards[][8], double stats[][8],
+                          int64_t (*tallies)[2][Tally::size]) {
+  Hand h, d;
+  if (parse_hand(hand, h) != HandError::none || h.size() != StandardRules::deal_size ||
+      (dead && parse_hand(dead, d) > HandError::empty))
+    return -1;
+  try {
+    check_dead(variant_for(StandardRules::name), h, d);
+  } catch (std::runtime_error const &) {
+    return -3;
+  }
+  try {
+    int n = 0;
+    auto store = [&](Hand discard, auto const &mine_tally, Statistics if_mine,
+                     auto const &theirs_tally, Statistics if_theirs) {
+      auto *name = discards[n];
+      for (auto card = discard.take(); card; card = discard.take()) {
+        *name++ = rank_chars[card.rank()];
+        *name++ = suit_chars[card.suit()];
+        *name++ = discard.size() ? ' ' : '\0';
+      }
+      double const values[] = {if_mine.mean, if_mine.stdev, double(if_mine.min),
+                               double(if_mine.max), if_theirs.mean, if_theirs.stdev,
+                               double(if_theirs.min), double(if_theirs.max)};
+      std::copy(std::begin(values), std::end(values), stats[n]);
+      if (tallies)
+        for (size_t i = 0; i < Tally::size; ++i) {
+          tallies[n][0][i] = mine_tally.scores[i];
+          tallies[n][1][i] = theirs_tally.scores[i];
+        }
+      ++n;
+    };
+    if (opponent_model)
+      for_each_discard<StandardRules, true>(h, d, store);
+    else {
+      thread_local IncrementalAnalysis<StandardRules> incremental;
+      incremental.for_each_discard(h, d, store);
+    }
+    return n;
+  } catch (std::runtime_error const &) {
+    return -1;
+  } catch (...) {
+    return -2;
+  }
+}
+
+} // extern "C"
+
+// The command line, for callers that want it in process
+extern "C" int cribbage_main(int, char **argv)
+#else
 int main(int, char **argv)
+#endif
 try {
 
 #ifndef NDEBUG
@@ -715,31 +4476,424 @@ try {
     {
       throw "oops";
     }
+
+    // ...and the exact distribution
+    auto m = t.moments();
+    assert(m.n == 15180);
+    assert(m.sum == 347394);
+    assert(m.sum_squares == 8254772);
+    assert(t.percentile(0) == 16);
+    assert(t.percentile(0.5) == 22);
+    assert(t.percentile(1) == 53);
+    assert(t.at_least(53) == 1.0 / 15180);
+    assert(t.at_least(16) == 1.0);
+    assert(std::abs(t.stdev() - 4.47999) < 1e-5);
+
+    auto u = t;
+    u += t;
+    assert(u.moments().sum == 2 * m.sum);
+    assert(u.stdev() == t.stdev());
+    assert(u.percentile(0.5) == t.percentile(0.5));
+
+    // The variance is exact however large the counts
+    WeightedTally w;
+    w.add(29, 3'000'000'000'000);
+    assert(w.variance() == 0);
+    w.add(28, 3'000'000'000'000);
+    assert(w.variance() == 0.25);
   }
-#endif
 
-  while (*++argv)
-    analyze_hand(*argv);
+  // The factored scorer agrees with the direct one: every entry of the rank
+  // table, and a sample of hands for the flush and nobs bits
+  {
+    Rank r[5];
+    for (r[0] = 0; r[0] < num_ranks; ++r[0])
+    for (r[1] = r[0]; r[1] < num_ranks; ++r[1])
+    for (r[2] = r[1]; r[2] < num_ranks; ++r[2])
+    for (r[3] = r[2]; r[3] < num_ranks; ++r[3])
+    for (r[4] = r[3]; r[4] < num_ranks; ++r[4]) {
+      if (r[0] == r[4])
+        continue; // five of a kind
+      Hand hand;
+      for (size_t i = 0; i < 4; ++i)
+        hand.insert(Card{r[i], Suit(std::count(r, r + i, r[i]))});
+      Card cut{r[4], Suit(std::count(r, r + 4, r[4]))};
+      assert(rank_points[rank_multiset_index(r)] ==
+             score_15s(hand, cut) + score_pairs(hand, cut) + score_runs(hand, cut));
+    }
 
-  // with 29 in your hand, what's the most you could have in the crib?
-  if ((false)) {
-    const auto hand = make_hand("5H 5C 5S JD"); // 29 hand
-    const auto cut = make_card("5D");
-    assert(score_hand(hand, cut, false) == 29);
-    Hand deck{all_cards};
-    deck.remove(hand);
-    deck.remove(cut);
-    int best = 0;
-    for_each_choice(deck, 4, [&](Hand crib) {
-      auto score = score_hand(crib, cut, true);
-      if (best <= score) {
-        best = score;
-        cout << crib << " = " << score << '\n';
+    uint64_t state = 1;
+    for (int i = 0; i < 2000; ++i) {
+      Hand deck{all_cards};
+      Hand hand;
+      Card cards[5];
+      for (auto &card : cards) {
+        do {
+          state = state * 6364136223846793005 + 1442695040888963407;
+          card = Card{Rank(state >> 33 & 0xffff) % Rank(num_ranks), Suit(state >> 50) % Suit(num_suits)};
+        } while (!deck.has(card));
+        deck.remove(card);
+      }
+      for (size_t j = 0; j < 4; ++j)
+        hand.insert(cards[j]);
+      for (bool is_crib : {false, true})
+        assert(score_hand(hand, cards[4], is_crib) ==
+               score_hand_direct(hand, cards[4], is_crib));
+    }
+  }
+
+  // Writer's output is byte for byte what iostreams would write
+  {
+    auto check = [](double x, int digits) {
+      std::ostringstream ss;
+      ss << std::fixed << std::setprecision(digits) << x;
+      Writer out;
+      out.fixed(x, digits);
+      assert(out.view() == ss.str());
+    };
+    for (double x : {0.0, -0.0, 0.05, 0.15, 0.25, -0.25, 2.5, 3.5, -0.04, 0.95,
+                     9.95, 99.95, 1e-300, -1e-300, 0x1p52, 1e300, 22.85, 15180.0,
+                     std::nan(""), HUGE_VAL, -HUGE_VAL})
+      for (int digits = 0; digits <= 4; ++digits)
+        check(x, digits);
+    uint64_t state = 1;
+    for (int i = 0; i < 2000; ++i) {
+      state = state * 6364136223846793005 + 1442695040888963407;
+      auto x = int64_t(state >> 20) / 1e6 - 1e6 * ((state & 1) == 0);
+      check(x, i % 5);
+      check(x / 1024, i % 5);
+    }
+
+    Tally t{};
+    t.add(-3, 2);
+    t.add(17, 1234);
+    Statistics st(-1.25, 0.05, -16, 29);
+    std::ostringstream ss;
+    ss << st << ' ' << make_hand("5H TS JD") << ' ' << -1234567 << '\n';
+    Writer out;
+    out << st << ' ' << make_hand("5H TS JD") << ' ' << -1234567 << '\n';
+    assert(out.view() == ss.str());
+    out.clear();
+    out << t;
+    assert(out.view() == "-3:2 17:1234");
+  }
+
+  // unit test for IncrementalAnalysis: every edit matches a fresh analysis
+  {
+    IncrementalAnalysis<StandardRules> incremental;
+    std::pair<std::string_view, std::string_view> const edits[] = {
+      {"5S 4D JD 4C 5C 5H", ""},
+      {"5S 4D JD 4C 5C 6H", ""},      // swap a card
+      {"5S 4D JD 4C 5C 6H", "2C KH"}, // two cards dead
+      {"5S 4D QD 4C 5C 6H", "2C"},    // both at once
+    };
+    for (auto [deal, dead] : edits) {
+      auto const hand = make_hand(deal);
+      auto const dead_cards = make_hand(dead);
+      std::vector<Tally> expected;
+      for_each_discard<StandardRules>(hand, dead_cards, [&](Hand, Tally const &mine, Statistics,
+                                                            Tally const &theirs, Statistics) {
+        expected.push_back(mine);
+        expected.push_back(theirs);
+      });
+      size_t i = 0;
+      incremental.for_each_discard(hand, dead_cards, [&](Hand, Tally const &mine, Statistics,
+                                                         Tally const &theirs, Statistics) {
+        for (auto *tally : {&mine, &theirs}) {
+          assert(std::equal(std::begin(tally->scores), std::end(tally->scores),
+                            std::begin(expected[i].scores)));
+          ++i;
+        }
+      });
+      assert(i == expected.size());
+    }
+    assert(incremental.recounted == 15 + 5 + 0 + 5);
+    assert(incremental.updated == 0 + 10 + 15 + 10);
+  }
+
+  // unit test for JointTally: both crib owners' tallies from one count
+  {
+    JointTally joint;
+    joint.add(29, 0);
+    joint.add(12, 24, 3);
+    joint.add(0, 29);
+    auto const mine = joint.mine();
+    auto const theirs = joint.theirs();
+    assert(mine.count(29) == 2 && mine.count(36) == 3 && mine.moments().n == 5);
+    assert(theirs.count(29) == 1 && theirs.count(-12) == 3 && theirs.count(-29) == 1);
+  }
+
+  // unit test for StatsTable: quantized statistics print as the originals
+  // did, and a table survives a round trip but not a flipped bit
+  {
+    auto tenths = [](double x) {
+      Writer out;
+      out.fixed(x, 1);
+      return std::string(out.view());
+    };
+    uint64_t state = 1;
+    for (int i = 0; i < 2000; ++i) {
+      state = state * 6364136223846793005 + 1442695040888963407;
+      auto x = double(state >> 11) / 0x1p53 * 80 - 29;
+      for (auto y : {x, std::round(x * 20) / 20, std::round(x * 4) / 4}) // and midpoints
+        assert(tenths(StatsTable::quantize<int16_t>(y) / 100.0) == tenths(y));
+      auto sd = std::abs(x);
+      assert(tenths(StatsTable::quantize<uint16_t>(sd) / 100.0) == tenths(sd));
+    }
+
+    auto results_for = [](Hand deal) {
+      std::vector<DiscardResult> results;
+      for_each_discard<StandardRules>(deal, Hand{}, [&](Hand discard, Tally const &,
+                                                        Statistics mine, Tally const &,
+                                                        Statistics theirs) {
+        results.push_back({discard, mine, theirs});
+      });
+      std::reverse(results.begin(), results.end()); // any order will do
+      return results;
+    };
+    auto const deals = {make_hand("5S 4D JD 4C 5C 5H"), make_hand("AS AD AC AH TH JH")};
+    StatsTable table;
+    StatsTable staged[2];
+    for (size_t i = 0; auto deal : deals) {
+      auto const results = results_for(deal);
+      table.add(deal, 2, 1, Hand{}, results);
+      staged[i++].add(deal, 2, 1, Hand{}, results);
+    }
+    auto const bytes = table.serialize();
+    assert(bytes.size() == 56 + 2 * 8 + 2 * 16 + 4 * 64 + 4 * 32); // 30 discards, padded
+    StatsTable appended;
+    appended.append(staged[0]);
+    appended.append(staged[1]);
+    assert(appended.serialize() == bytes);
+    StatsTableView copy;
+    copy.parse(bytes, "copy");
+    Writer a;
+    copy.print(a);
+    assert(a.view().starts_with("[ 5S 4D JD 4C 5C 5H ]\n5S 4D [16.3 0.3 8..41] [3.1 0.3 -16..13]\n"));
+    // A deal differing only by suit is found, with its own discards
+    auto const relabeled = make_hand("5H 4C JC 4D 5D 5S");
+    auto const found = copy.lookup(relabeled, 1);
+    assert(found && found->size() == 15 && !copy.lookup(relabeled, 2));
+    assert(!copy.lookup(make_hand("5S 4D JD 4C 5C 6H"), 1));
+    for (auto &r : results_for(relabeled)) {
+      auto f = std::find_if(found->begin(), found->end(), [&](auto &f) {
+        return f.discard.bits() == r.discard.bits();
+      });
+      assert(f != found->end());
+      Writer x, y;
+      x << r.if_mine << r.if_theirs;
+      y << f->if_mine << f->if_theirs;
+      assert(x.view() == y.view());
+    }
+    for (size_t i : {size_t(3), size_t(60), bytes.size() - 1}) {
+      auto corrupt = bytes;
+      corrupt[i] ^= 4;
+      bool caught = false;
+      try {
+        copy.parse(corrupt, "corrupt");
+      } catch (std::runtime_error const &) {
+        caught = true;
       }
+      assert(caught);
+    }
+  }
+
+  // unit test for head to head: the same whatever the number of jobs, and
+  // keeping four 5s nets the most
+  {
+    auto run = [](unsigned jobs) {
+      Options options;
+      options.jobs = jobs;
+      options.samples = 500;
+      auto &out = output();
+      out.clear();
+      analyze_head_to_head<StandardRules>(make_hand("5S 5D 5C 5H JD KS"), options);
+      std::string report(out.view());
+      out.clear();
+      return report;
+    };
+    auto const report = run(1);
+    assert(report == run(3));
+    auto mean = [&](std::string_view discard) {
+      auto line = report.substr(report.find(std::string(discard) + " ["));
+      return std::stod(std::string(line.substr(discard.size() + 2)));
+    };
+    for (auto other : {"5S KS", "5S JD", "5S 5D"})
+      assert(mean("KS JD") > mean(other) + 2);
+  }
+
+  // unit test for the queries: the 29 hands, and the best crib alongside one
+  {
+    size_t n = 0;
+    for_each_query_match({false, 29, 29}, 2, [&](Hand hand, Card cut, int score) {
+      assert(score == 29 && score_hand(hand, cut, false) == 29);
+      ++n;
     });
+    assert(n == 4);
+    size_t at_least_24 = 0;
+    for_each_query_match({true, 24}, 2, [&](Hand hand, Card cut, int score) {
+      assert(score >= 24 && score_hand(hand, cut, true) == score);
+      ++at_least_24;
+    });
+    assert(at_least_24 == 3680 + 76 + 4);
+
+    int best;
+    auto cribs = best_cribs(make_hand("5H 5C 5S JD"), make_card("5D"), 2, best);
+    assert(best == 24 && cribs.size() == 36);
+    assert(score_hand(cribs.front(), make_card("5D"), true) == 24);
+  }
+#endif
+
+  // Options apply to the arguments that follow them
+  std::string_view rules = StandardRules::name;
+  Mode mode = Mode::exact;
+  Options options;
+  std::unique_ptr<ResultCache> cache;
+  std::unique_ptr<StatsTable> table;
+  std::string table_path;
+  std::unique_ptr<StatsTableView> use_table;
+  auto write_table = [&] {
+    if (table)
+      table->write(table_path);
+    if (table && options.verbose)
+      std::clog << "table: " << table->size() << " deals in " << table_path << '\n';
+  };
+  std::vector<Hand> batch; // deals waiting for --batch
+  auto flush_batch = [&] {
+    if (!batch.empty())
+      variant_for(rules).analyze_batch(batch, options);
+    batch.clear();
+  };
+  auto analyze = [&](Hand hand) {
+    check_dead(variant_for(rules), hand, options.dead);
+    if (options.batch && mode == Mode::exact && variant_for(rules).analyze_batch &&
+        !options.table && !options.use_table)
+      batch.push_back(hand);
+    else
+      analyzer_for(rules, mode)(hand, options);
+  };
+  while (*++argv) {
+    std::string_view arg = *argv;
+    auto value = arg.substr(std::min(arg.find('='), arg.size() - 1) + 1);
+    if (arg.starts_with("--")) {
+      flush_batch();
+      output().flush(); // before anything else writes to stdout
+    }
+    if (arg.starts_with("--rules="))
+      rules = value;
+    else if (arg == "--opponent-model")
+      mode = Mode::opponent_model;
+    else if (arg == "--hold-only")
+      mode = Mode::hold_only;
+    else if (arg == "--sampled")
+      mode = Mode::sampled;
+    else if (arg == "--head-to-head")
+      mode = Mode::head_to_head;
+    else if (arg.starts_with("--samples="))
+      options.samples = std::stoi(std::string(value));
+    else if (arg.starts_with("--deadline="))
+      options.deadline_ms = std::stod(std::string(value));
+    else if (arg == "--serve")
+      serve_requests(rules, mode, options);
+    else if (arg.starts_with("--jobs="))
+      options.jobs = std::max(1, std::stoi(std::string(value)));
+    else if (arg == "--format=csv" || arg == "--format=binary")
+      options.binary = value == "binary";
+    else if (arg.starts_with("--cache=")) {
+      cache = std::make_unique<ResultCache>(std::string(value));
+      options.cache = cache.get();
+    }
+    else if (arg == "--verbose")
+      options.verbose = true;
+    else if (arg.starts_with("--table=")) {
+      write_table();
+      table = std::make_unique<StatsTable>();
+      table_path = value;
+      options.table = table.get();
+    }
+    else if (arg.starts_with("--print-table=")) {
+      StatsTableView printed;
+      printed.map(std::string(value));
+      printed.print(output());
+    }
+    else if (arg.starts_with("--use-table=")) {
+      use_table = std::make_unique<StatsTableView>();
+      use_table->map(std::string(value));
+      options.use_table = use_table.get();
+    }
+    else if (arg == "--distribution")
+      options.distribution = true;
+    else if (arg == "--warm")
+      warm_shared_tables(options);
+    else if (arg == "--batch")
+      options.batch = true;
+    else if (arg.starts_with("--dead="))
+      options.dead = make_hand(value);
+    else if (arg.starts_with("--at-least="))
+      options.at_least = std::stoi(std::string(value));
+    else if (arg.starts_with("--risk="))
+      options.risk = std::stod(std::string(value));
+    else if (arg == "--crib-table")
+      print_crib_table(Hand{}, options);
+    else if (arg.starts_with("--crib-table=")) {
+      auto held = make_hand(value);
+      if (held.size() != 4)
+        throw std::runtime_error("Expected four held cards '" + std::string(value) + '\'');
+      print_crib_table(held, options);
+    }
+    else if (arg.starts_with("--shard=")) {
+      auto slash = value.find('/');
+      if (slash == value.npos)
+        throw std::runtime_error("Expected --shard=I/N '" + std::string(arg) + '\'');
+      options.shard = unsigned(std::stoi(std::string(value.substr(0, slash))));
+      options.num_shards = unsigned(std::max(1, std::stoi(std::string(value.substr(slash + 1)))));
+    }
+    else if (arg.starts_with("--checkpoint="))
+      options.checkpoint = value;
+    else if (arg.starts_with("--enumerate=")) {
+      auto kind = std::find(std::begin(enumeration_names), std::end(enumeration_names), value);
+      if (kind == std::end(enumeration_names))
+        throw std::runtime_error("Unknown enumeration '" + std::string(value) + '\'');
+      enumerate(Enumeration(kind - std::begin(enumeration_names)), options);
+    }
+    else if (arg.starts_with("--merge="))
+      merge_shards(value);
+    else if (arg.starts_with("--query="))
+      run_query(value, options);
+    else if (arg == "--pipeline")
+      options.pipeline = true;
+    else if (arg.starts_with("--file=")) {
+      auto num_bad = options.pipeline
+        ? analyze_file_pipelined(std::string(value), rules, mode, options)
+        : for_each_deal_in_file(std::string(value), variant_for(rules).deal_size, analyze);
+      flush_batch();
+      if (num_bad)
+        throw std::runtime_error(std::to_string(num_bad) + " bad deals in '" +
+                                 std::string(value) + '\'');
+    }
+    else if (arg.starts_with("--"))
+      throw std::runtime_error("Unknown option '" + std::string(arg) + '\'');
+    else
+      analyze(make_deal(rules, arg));
+  }
+  flush_batch();
+  output().flush();
+  write_table();
+
+  if (options.verbose && cache)
+    std::clog << "cache: " << cache->hits << " hits, " << cache->misses << " misses\n";
+  if (options.verbose && shared_tables_status.looked)
+  {
+    if (shared_tables_status.attached)
+      std::clog << "tables: attached " << shared_tables_name << " in " << std::fixed
+                << std::setprecision(1) << shared_tables_status.micros << "us\n";
+    else
+      std::clog << "tables: not warmed, computed them\n";
   }
 
+  return EXIT_SUCCESS;
 } catch (std::exception const &exc) {
+  output().flush();
   std::clog << "Caught exception: " << exc.what() << std::endl;
   return EXIT_FAILURE;
 }
@@ -0,0 +1,89 @@
+#!/usr/bin/env python
+# Copyright (c) 2021, Michael Cook <michael@waxrat.com>. All rights reserved.
+
+#
+# Python bindings to the C++ engine in libcribbage.so (`make libcribbage.so`),
+# using only ctypes.  Hands are strings like '5H 5C 5S JD'.
+#
+# Importing this raises OSError if the library hasn't been built, so callers
+# can fall back to pure Python.
+#
+
+from __future__ import annotations
+import ctypes
+import os
+from typing import Final, NamedTuple
+
+NUM_SCORES: Final = 30    # 0..29
+NUM_DISCARDS: Final = 15  # C(6,2)
+
+_LIB: Final = ctypes.CDLL(os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                                       'libcribbage.so'))
+
+_LIB.cribbage_score_hand.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_int]
+_LIB.cribbage_score_hand.restype = ctypes.c_int
+_LIB.cribbage_hand_distribution.argtypes = [ctypes.c_int, ctypes.c_uint,
+                                            ctypes.POINTER(ctypes.c_uint64)]
+_LIB.cribbage_hand_distribution.restype = ctypes.c_int
+_LIB.cribbage_min_score.restype = ctypes.c_int
+_LIB.cribbage_max_score.restype = ctypes.c_int
+_LIB.cribbage_analyze_hand.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_int,
+                                       ctypes.c_void_p, ctypes.c_void_p, ctypes.c_void_p]
+_LIB.cribbage_analyze_hand.restype = ctypes.c_int
+
+MIN_SCORE: Final[int] = _LIB.cribbage_min_score()
+MAX_SCORE: Final[int] = _LIB.cribbage_max_score()
+
+class Statistics(NamedTuple):
+    mean: float
+    stdev: float
+    min: int
+    max: int
+
+class Discard(NamedTuple):
+    discard: str
+    if_mine: Statistics
+    if_theirs: Statistics
+    # The weight of each score MIN_SCORE..MAX_SCORE
+    mine_tally: list[int]
+    theirs_tally: list[int]
+
+def _check(result: int, what: str) -> int:
+    if result == -1:
+        raise RuntimeError(f'Malformed hand: {what}')
+    if result == -3:
+        raise RuntimeError(f'Bad dead cards: {what}')
+    if result < 0:
+        raise RuntimeError(f'Failed: {what}')
+    return result
+
+def score_hand(hand: str, cut: str, is_crib: bool) -> int:
+    return _check(_LIB.cribbage_score_hand(hand.encode(), cut.encode(), int(is_crib)),
+                  f'{hand} {cut}')
+
+# How many of the 12,994,800 hands (or cribs) have each score 0..29.
+# `jobs` of zero means a thread per CPU.
+def hand_distribution(is_crib: bool = False, jobs: int = 0) -> list[int]:
+    counts = (ctypes.c_uint64 * NUM_SCORES)()
+    _check(_LIB.cribbage_hand_distribution(int(is_crib), jobs, counts), 'distribution')
+    return list(counts)
+
+# `dead` cards are known to be out of the deck, so never in the crib or cut
+def analyze_hand(hand: str, opponent_model: bool = False, dead: str = '') -> list[Discard]:
+    num_tally = MAX_SCORE - MIN_SCORE + 1
+    discards = (ctypes.c_char * 8 * NUM_DISCARDS)()
+    stats = (ctypes.c_double * 8 * NUM_DISCARDS)()
+    tallies = (ctypes.c_int64 * num_tally * 2 * NUM_DISCARDS)()
+    n = _check(_LIB.cribbage_analyze_hand(hand.encode(), dead.encode(), int(opponent_model),
+                                          discards, stats, tallies), f'{hand} dead {dead}')
+    results = []
+    for i in range(n):
+        s = list(stats[i])
+        results.append(Discard(discards[i].value.decode(),
+                               Statistics(s[0], s[1], int(s[2]), int(s[3])),
+                               Statistics(s[4], s[5], int(s[6]), int(s[7])),
+                               list(tallies[i][0]), list(tallies[i][1])))
+    return results
+
+assert 29 == score_hand('5H 5C 5S JD', '5D', False)
+assert 0 == score_hand('AH 3H 7H TH', 'JS', True)
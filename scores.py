@@ -380,7 +380,7 @@ def make_deck() -> Hand:
             deck.push(card)
     return deck
 
-def main() -> None:
+def count_scores() -> list[int]:
     deck: Final = make_deck()
     scores = [0] * 30    # 0..29
     for hand in choose(deck, 4):
@@ -391,6 +391,15 @@ def main() -> None:
             score = score_hand(hand, False)
             hand.pop()
             scores[score] += 1
+    return scores
+
+def main() -> None:
+    # The C++ engine does the same count in seconds, if it's been built
+    try:
+        import cribbage_native  # pylint: disable=import-outside-toplevel
+        scores = cribbage_native.hand_distribution()
+    except OSError:
+        scores = count_scores()
     num_hands = sum(scores)
     for score, count in enumerate(scores):
         perc = count * 100 / num_hands